@@ -1,4 +1,4 @@
-#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +8,17 @@
 #include <time.h>
 #include <dirent.h>
 #include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
 
 #define NOB_IMPLEMENTATION
 #include "nob.h"
@@ -30,14 +41,70 @@ int max_records = MAX_RECORDS;
 int list_records_flag = false;
 int dump_records_flag = false;
 int verbose_flag = false;
+int event_filter_flag = false;
+int blob_store_flag = false;
+int inventory_flag = false;
+int rollup_flag = false; // merge rop level outputs into the hourly and daily stores of the output directory
+int recursive_flag = false;
+int sort_flag = false;
+int prefetch_depth = 4; // files opened and read ahead of the parser, 0 - off
+int io_uring_flag = false;
+int direct_io_flag = false; // read input with O_DIRECT, keep it out of the page cache
+int num_threads = 0; // 0 - number of online cpus
+int decoder_threads = 1; // parse_file threads between the prefetcher and the writer
+int unordered_flag = false; // write parsed files as they finish instead of in input order
+int aggregate_flag = false;  // count events per site/date/rop/event instead of writing the records
+int merge_flag = false;      // one time ordered records csv per site instead of one per file
+int timeline_flag = false;   // all events of the run sorted by time to ctr_timeline.csv
+int timeline_run = 1024 * 1024; // --timeline-run, events sorted in memory before a run is spilled
+int kpi_bin_seconds = 0;     // --kpi-bin, 0 - one count per kpi group for the whole run
+int session_timeout_ms = 30 * 1000; // --session-timeout, idle time after which a UE session is closed
+int sample_rate = 0;                // --sample, keep the events of 1 in N UEs, 0 - off
+int64_t time_filter_from = INT64_MIN; // --from, minutes since epoch of the rop start
+int64_t time_filter_to = INT64_MAX;   // --to (exclusive)
+
+enum OnError
+{
+    ON_ERROR_RESYNC,     // scan forward to the next plausible record and go on
+    ON_ERROR_QUARANTINE, // drop the file and list it in ctr_files_quarantined.csv
+};
+enum OnError on_error = ON_ERROR_RESYNC;
+int files_quarantined = 0;
+
+typedef struct InputPaths
+{
+    const char **items;
+    size_t count;
+    size_t capacity;
+} InputPaths;
 
-const char *input_dir = {0};
+InputPaths input_paths = {0};  // -i directories and positional files or directories
+const char *file_list_arg = {0}; // --file-list path, '-' for stdin
 const char *output_dir = {0};
+const char *event_filter_arg = {0}; // comma separated event names or ids given with -e/--events
+const char *event_predicate_arg = {0}; // parameter filter expression given with -w/--where
+const char *event_columns_arg = {0};   // per event parameter projection given with --columns
+const char *site_filter_arg = {0};     // comma separated node names given with --site
+const char *kpi_definitions_arg = {0}; // --kpi counter definitions file
+const char *session_key_arg = {0};     // --sessions, UE reference param events are correlated on
+const char *sample_param_arg = "EVENT_PARAM_RAC_UE_REF"; // --sample-param, UE param hashed by --sample
+const char *latency_definitions_arg = {0}; // --latency event pair definitions file
 
 const char PmEventParams_filepath[] = "config/PmEventParams.cfg";
 const char files_filename_format[255] = "%s/ctr_files_parsed.csv";          // <output_folder>/ctr_files_parsed.csv
-const char records_filename_format[255] = "%s/ctr_records_%s_%s_%s.csv\n";  // <output_folder>/..._<sitename>_<day>_<rop>
-const char events_filename_format[255] = "%s/ctr_events_%s_%s_%s_%s.csv\n"; // <output_folder>/...<event name>_<sitename>_<day>_<rop>
+const char quarantine_filename_format[255] = "%s/ctr_files_quarantined.csv"; // <output_folder>/ctr_files_quarantined.csv
+const char inventory_filename_format[255] = "%s/ctr_inventory.csv";          // <output_folder>/ctr_inventory.csv
+const char sessions_filename_format[255] = "%s/ctr_sessions.csv";             // <output_folder>/ctr_sessions.csv
+const char latency_filename_format[255] = "%s/ctr_latency.csv";               // <output_folder>/ctr_latency.csv
+const char kpi_filename_format[255] = "%s/ctr_kpi.csv";                       // <output_folder>/ctr_kpi.csv
+const char sketches_filename_format[255] = "%s/ctr_kpi_sketches.csv";         // <output_folder>/ctr_kpi_sketches.csv
+const char aggregate_filename_format[255] = "%s/ctr_aggregate.csv";           // <output_folder>/ctr_aggregate.csv
+const char rollup_filename_format[255] = "%s/ctr_rollup_%s_%s.csv";        // <output_folder>/..._<aggregate|sketches>_<rop|hourly|daily>
+const char records_filename_format[255] = "%s/ctr_records_%s_%s_%s.csv";  // <output_folder>/..._<sitename>_<day>_<rop>
+const char merged_filename_format[255] = "%s/ctr_merged_%s.csv";          // <output_folder>/..._<sitename>
+const char timeline_filename_format[255] = "%s/ctr_timeline.csv";          // <output_folder>/ctr_timeline.csv
+const char events_filename_format[255] = "%s/ctr_events_%s_%s_%s_%s.csv"; // <output_folder>/...<event name>_<sitename>_<day>_<rop>
+const char blobs_filename_format[255] = "%s/ctr_blobs_%s_%s_%s.bin";       // <output_folder>/..._<sitename>_<day>_<rop>
 
 /* CHAR_BIT == 8 assumed */
 uint16_t le16_to_cpu(const uint8_t *buf)
@@ -119,18 +186,38 @@ typedef struct RecordLenType
     uint16_t type;
 } RecordLenType;
 
+/* raw time fields as found in the records, only formatted to text by the text sinks */
+typedef struct CTRDateTime
+{
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+} CTRDateTime;
+
+typedef struct CTRTime
+{
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint16_t millisecond;
+} CTRTime;
+
 typedef struct CTRHeader
 {
     uint16_t length;
-    uint8_t date[9];             //  5 bytes + termination char (yyyy-mm-dd)
-    uint8_t rop[5];              //  5 bytes + termination char (yyyy-mm-dd)
-    uint8_t parse_timestamp[20]; //  18 bytes + termination char (yyyy-mm-dd hh:mm:ss)
+    time_t parse_time;
     uint32_t num_records;
+    uint32_t skipped_bytes; // bytes of corrupt framing skipped while walking the file
+    struct EventCount *event_counts; // --aggregate, events of the file by id
+    struct SessionRows *sessions;    // --sessions, UE sessions closed while parsing the file
     uint8_t file_name[256];
     uint8_t file_version[6];       //  5 bytes + termination char
     uint8_t pm_version[14];        // 13 bytes + termination char
     uint8_t pm_revision[6];        //  5 bytes + termination char
-    uint8_t date_time[20];         //  7 bytes + termination char (yyyy-mm-dd hh:mm:ss)
+    CTRDateTime date_time;         //  7 bytes, date and rop of the file
     uint8_t ne_user_label[129];    // 128 bytes + termination char
     uint8_t ne_logical_label[256]; // 255 bytes + termination char
 } CTRHeader;
@@ -138,7 +225,7 @@ typedef struct CTRHeader
 typedef struct CTRScanner
 {
     uint16_t length;
-    uint8_t timestamp[13];
+    CTRTime timestamp;
     uint8_t scannerid[3];
     uint8_t status[1];
     uint8_t padding[3];
@@ -149,13 +236,16 @@ typedef struct CTREvent
     uint16_t length;
     int id;
     char name[128];
+    bool has_timestamp; // event config has the EVENT_PARAM_TIMESTAMP_* params
+    CTRTime timestamp;
     uint8_t *parameters;
+    struct CTRParamValue *values; // decoded --columns of the event, NULL when not projected
 } CTREvent;
 
 typedef struct CTRFooter
 {
     uint16_t length;
-    uint8_t date_time[20]; //  7 bytes + termination char (yyyy-mm-dd hh:mm:ss)
+    CTRDateTime date_time;
     uint8_t padding[1];
 } CTRFooter;
 
@@ -174,12 +264,22 @@ typedef struct CTRStruct
     };
 } CTRStruct;
 
+enum ParamKind
+{
+    PARAM_UINT = 0,      // size bits, unsigned integer (UINT, ENUM, LONG, ...)
+    PARAM_BYTES = 1,     // size bits, raw bytes (wider than 64 bits)
+    PARAM_BYTEARRAY = 2, // 16 bit length in bytes followed by the bytes (size is the max length)
+};
+
 typedef struct ParamsList
 {
     char name[256]; /* key (string is WITHIN the structure) */
-    bool unavailable_flag;
+    bool unavailable_flag; /* param is preceded by 1 bit set when the value is not available */
     char type[256];
     int size;
+    enum ParamKind kind;
+    int bit_offset; /* fixed offset inside the event parameters, -1 after a variable length param */
+    int column;     /* index in the --columns output of the event, -1 when not selected */
     struct ParamsList *next;
     UT_hash_handle hh; /* makes this structure hashable */
 } ParamsList;
@@ -189,6 +289,15 @@ typedef struct EventConfig
     int id; /* key */
     char name[128];
     char type[128];
+    bool selected; /* event passes the -e/--events allow-list */
+    struct ParamsList **filter_params; /* params referenced by the -w/--where filter, by slot */
+    struct ParamsList *timestamp_params[4]; /* EVENT_PARAM_TIMESTAMP_HOUR/MINUTE/SECOND/MILLISEC */
+    int n_columns;                     /* params selected with --columns, 0 when not decoded */
+    struct ParamsList *last_column;    /* decoding stops after this param */
+    struct Kpi **kpis;                 /* --kpi counters of this event */
+    int n_kpis;
+    struct ParamsList *session_param;  /* --sessions UE reference, NULL when the event has none */
+    struct ParamsList *sample_param;   /* --sample UE param, NULL when the event has none */
     struct ParamsList *params_head;
     struct EventConfig *next;
     UT_hash_handle hh; /* makes this structure hashable */
@@ -213,20 +322,12 @@ int free_pm_event_params(EventConfig *event)
 ParamsList *find_pm_event_param_by_name(EventConfig *event, const char *param_name)
 {
     ParamsList *param = event->params_head;
-    while (param->name != param_name && param->next != NULL)
+    while (param != NULL && strcmp(param->name, param_name) != 0)
     {
         param = param->next;
     }
 
-    if (strcmp(param->name, param_name) != 0)
-    {
-        return NULL;
-    }
-    else
-    {
-        return param;
-    }
-    return NULL;
+    return param;
 }
 
 ParamsList *find_pm_event_param_tail(EventConfig *event)
@@ -250,10 +351,41 @@ ParamsList *add_pm_event_param(const char *param_name, bool param_unavailable_fl
     s->unavailable_flag = param_unavailable_flag;
     strcpy(s->type, param_type);
     s->size = param_size;
+    s->bit_offset = -1;
+    s->column = -1;
+
+    if (strcmp(param_type, "BYTEARRAY") == 0)
+        s->kind = PARAM_BYTEARRAY;
+    else if (param_size > 64)
+        s->kind = PARAM_BYTES;
+    else
+        s->kind = PARAM_UINT;
 
     return s;
 }
 
+/* set the fixed bit offset of every param that is not preceded by a variable length one */
+void layout_pm_event_params(EventConfig *event)
+{
+    event->timestamp_params[0] = find_pm_event_param_by_name(event, "EVENT_PARAM_TIMESTAMP_HOUR");
+    event->timestamp_params[1] = find_pm_event_param_by_name(event, "EVENT_PARAM_TIMESTAMP_MINUTE");
+    event->timestamp_params[2] = find_pm_event_param_by_name(event, "EVENT_PARAM_TIMESTAMP_SECOND");
+    event->timestamp_params[3] = find_pm_event_param_by_name(event, "EVENT_PARAM_TIMESTAMP_MILLISEC");
+
+    int bit_offset = 0;
+    for (ParamsList *param = event->params_head; param != NULL; param = param->next)
+    {
+        param->bit_offset = bit_offset;
+        if (bit_offset < 0)
+            continue;
+
+        if (param->kind == PARAM_BYTEARRAY)
+            bit_offset = -1;
+        else
+            bit_offset += param->size + (param->unavailable_flag ? 1 : 0);
+    }
+}
+
 int free_pm_events(EventConfig *event)
 {
     free_pm_event_params(event);
@@ -293,6 +425,77 @@ const char *get_pm_event_name_by_id(int id)
     return event_name;
 }
 
+struct EventConfig *find_pm_event_by_name(const char *name)
+{
+    struct EventConfig *s, *tmp;
+
+    HASH_ITER(hh, event_hash, s, tmp)
+    {
+        if (strcmp(s->name, name) == 0)
+            return s;
+    }
+    return NULL;
+}
+
+/* true when the event id passes the -e/--events allow-list (or no list is set) */
+bool pm_event_selected(int id)
+{
+    if (!event_filter_flag)
+        return true;
+
+    struct EventConfig *event = find_pm_event(id);
+    return event != NULL && event->selected;
+}
+
+/* resolve the -e/--events argument (names or ids) against the loaded config */
+int resolve_event_filter(const char *arg)
+{
+    Nob_String_View list = nob_sv_from_cstr(arg);
+    int selected = 0;
+
+    while (list.count > 0)
+    {
+        Nob_String_View item = nob_sv_trim(nob_sv_chop_by_delim(&list, ','));
+        if (item.count == 0)
+            continue;
+
+        const char *item_cstr = nob_temp_sv_to_cstr(item);
+        struct EventConfig *event = NULL;
+        char *end = NULL;
+        long id = strtol(item_cstr, &end, 10);
+        if (*end == '\0')
+            event = find_pm_event((int)id);
+        else
+            event = find_pm_event_by_name(item_cstr);
+
+        if (event == NULL)
+        {
+            printf("[ WRN ]: Event filter '%s' not found in config\n", item_cstr);
+            continue;
+        }
+
+        if (!event->selected)
+        {
+            event->selected = true;
+            selected++;
+        }
+        if (verbose_flag)
+            printf("[ CFG ]: Event filter add %s (%d)\n", event->name, event->id);
+    }
+    nob_temp_reset();
+
+    if (selected == 0)
+    {
+        printf("[ ERR ]: No event of the event filter '%s' found in config\n", arg);
+        exit(EXIT_FAILURE);
+    }
+
+    event_filter_flag = true;
+    printf("[ CFG ]: Event filter set to %d event types\n", selected);
+
+    return selected;
+}
+
 EventConfig *add_pm_Event(int event_id, const char *event_name, const char *event_type)
 {
     struct EventConfig *s;
@@ -324,292 +527,3058 @@ int RecordTypeValid(uint16_t type)
     return valid;
 }
 
-/* when return 1, scandir will put this dirent to the list */
-static int parse_ext_bin(const struct dirent *dir)
+/* days since 1970-01-01 of a civil date (proleptic gregorian) */
+int64_t days_from_civil(int y, unsigned m, unsigned d)
 {
-    if (!dir)
-        return 0;
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
 
-    if (dir->d_type == DT_REG) /* only deal with regular file */
-    {
-        const char *ext = strrchr(dir->d_name, '.');
-        if ((!ext) || (ext == dir->d_name))
-            return 0;
-        else
-        {
-            if (strcmp(ext, ".bin") == 0)
-                return 1;
-        }
-    }
+int64_t ctr_date_time_minutes(const CTRDateTime *dt)
+{
+    return days_from_civil(dt->year, dt->month, dt->day) * 24 * 60 + dt->hour * 60 + dt->minute;
+}
 
-    return 0;
+int64_t ctr_date_time_epoch_ms(const CTRDateTime *dt)
+{
+    return (ctr_date_time_minutes(dt) * 60 + dt->second) * 1000;
 }
 
-void scan_string_from_buf(uint8_t *target_var, uint8_t *buf, uint16_t *buf_pos, uint16_t size)
+/* parse n digits, -1 when they are not all digits */
+int parse_digits(const char *s, int n)
 {
-    for (int i = 0; i < size; i++)
+    int value = 0;
+    for (int i = 0; i < n; i++)
     {
-        target_var[i] = buf[*buf_pos + i];
+        if (!isdigit((unsigned char)s[i]))
+            return -1;
+        value = value * 10 + (s[i] - '0');
     }
-    target_var[size + 1] = '\0';
-    *buf_pos = *buf_pos + size;
+    return value;
 }
 
-void scan_bytes_from_buf(uint8_t *target_var, uint8_t *buf, uint16_t *buf_pos, uint16_t size)
+/* yyyymmdd.hhmm (separators are optional) to minutes since epoch, -1 on bad input */
+int64_t parse_filter_time(const char *s)
 {
-    for (int i = 0; i < size; i++)
+    char digits[13] = {0};
+    int n = 0;
+    for (; *s != '\0' && n < 12; s++)
     {
-        target_var[i] = buf[*buf_pos + i];
+        if (isdigit((unsigned char)*s))
+            digits[n++] = *s;
     }
-    *buf_pos = *buf_pos + size;
+    if (n != 12)
+        return -1;
+
+    CTRDateTime dt = {parse_digits(digits, 4), parse_digits(digits + 4, 2), parse_digits(digits + 6, 2),
+                      parse_digits(digits + 8, 2), parse_digits(digits + 10, 2), 0};
+    return ctr_date_time_minutes(&dt);
 }
 
-void scan_current_timestamp(uint8_t *target_var)
+/* node name out of "...MeContext=<node>,..." or the text up to the first delimiter */
+void ctr_node_name(const char *s, const char *delims, char *out, size_t size)
 {
-    char buff[100];
-    time_t now = time(0);
-    strftime(buff, 100, "%Y-%m-%d %H:%M:%S", localtime(&now));
-    strcpy((char *)target_var, (char *)buff);
+    const char *me_context = strstr(s, "MeContext=");
+    if (me_context != NULL)
+    {
+        s = me_context + strlen("MeContext=");
+        delims = ","; // node names may hold '_'
+    }
+
+    size_t n = strcspn(s, delims);
+    if (n >= size)
+        n = size - 1;
+    memcpy(out, s, n);
+    out[n] = '\0';
 }
 
-void scan_date(uint8_t *target_var, uint8_t *buf, uint16_t *buf_pos)
+/*
+ * Standard CTR file name:
+ *     A<yyyymmdd>.<hhmm>[+-zzzz]-[<yyyymmdd>.]<hhmm>[+-zzzz]_<node>[_celltracefile...]
+ *     A20240517.1000+0200-1015+0200_SubNetwork=ONRM,MeContext=SiteA_celltracefile_DUL1_1.bin
+ * The start is the local time of the name, like the header date; the zone is
+ * skipped, so --from/--to compare local times. rop_seconds is the time from
+ * start to end. node points at the node name, with the rest of the file name
+ * still behind it since the node may hold '_'.
+ * Returns false when the name does not follow it.
+ */
+bool parse_ctr_file_name(const char *name, CTRDateTime *start, int *rop_seconds, const char **node)
 {
-    snprintf((char *)target_var, 9,
-             "%04d%02d%02d",
-             be16_to_cpu(buf + *buf_pos),
-             (uint8_t)buf[*buf_pos + 2],
-             (uint8_t)buf[*buf_pos + 3]);
-    // does not move buf_pos
+    const char *p = name + 1;
+    memset(start, 0, sizeof *start);
+
+    if (!isalpha((unsigned char)name[0]) || parse_digits(p, 8) < 0 || p[8] != '.' || parse_digits(p + 9, 4) < 0)
+        return false;
+    start->year = parse_digits(p, 4);
+    start->month = parse_digits(p + 4, 2);
+    start->day = parse_digits(p + 6, 2);
+    start->hour = parse_digits(p + 9, 2);
+    start->minute = parse_digits(p + 11, 2);
+    p += 13;
+
+    if ((*p == '+' || *p == '-') && p[1] != '\0' && parse_digits(p + 1, 4) >= 0)
+        p += 5; // time zone
+    if (*p++ != '-')
+        return false;
+    CTRDateTime end = *start;
+    if (parse_digits(p, 8) >= 0 && p[8] == '.')
+    {
+        end.year = parse_digits(p, 4);
+        end.month = parse_digits(p + 4, 2);
+        end.day = parse_digits(p + 6, 2);
+        p += 9;
+    }
+    if (parse_digits(p, 4) < 0)
+        return false;
+    end.hour = parse_digits(p, 2);
+    end.minute = parse_digits(p + 2, 2);
+    int64_t minutes = ctr_date_time_minutes(&end) - ctr_date_time_minutes(start);
+    if (minutes <= 0)
+        minutes += 24 * 60; // rop ending on the next day without an end date
+    *rop_seconds = minutes * 60;
+    p += 4;
+    if ((*p == '+' || *p == '-') && parse_digits(p + 1, 4) >= 0)
+        p += 5;
+    if (*p++ != '_')
+        return false;
+
+    const char *me_context = strstr(p, "MeContext=");
+    *node = me_context ? me_context + strlen("MeContext=") : p;
+    return true;
 }
 
-void scan_rop(uint8_t *target_var, uint8_t *buf, uint16_t *buf_pos)
+bool site_selected(const char *node)
 {
-    snprintf((char *)target_var, 5,
-             "%02d%02d",
-             (uint8_t)buf[*buf_pos + 4],
-             (uint8_t)buf[*buf_pos + 5]);
-    // does not move buf_pos
+    if (!site_filter_arg)
+        return true;
+
+    Nob_String_View list = nob_sv_from_cstr(site_filter_arg);
+    while (list.count > 0)
+    {
+        Nob_String_View site = nob_sv_trim(nob_sv_chop_by_delim(&list, ','));
+        if (site.count == strlen(node) && strncmp(site.data, node, site.count) == 0)
+            return true;
+    }
+    return false;
 }
 
-void scan_date_time(uint8_t *target_var, uint8_t *buf, uint16_t *buf_pos)
+/* a --site name followed by the '_' before celltracefile, the ',' of a longer DN or the end of
+ * the name; the header decides on the exact node */
+bool site_name_selected(const char *rest)
 {
-    snprintf((char *)target_var, 20,
-             "%04d-%02d-%02d %02d:%02d:%02d",
-             be16_to_cpu(buf + *buf_pos),
-             (uint8_t)buf[*buf_pos + 2],
-             (uint8_t)buf[*buf_pos + 3],
-             (uint8_t)buf[*buf_pos + 4],
-             (uint8_t)buf[*buf_pos + 5],
-             (uint8_t)buf[*buf_pos + 6]);
-    *buf_pos = *buf_pos + 7;
+    if (!site_filter_arg)
+        return true;
+
+    Nob_String_View list = nob_sv_from_cstr(site_filter_arg);
+    while (list.count > 0)
+    {
+        Nob_String_View site = nob_sv_trim(nob_sv_chop_by_delim(&list, ','));
+        if (site.count > 0 && strncmp(site.data, rest, site.count) == 0 && (rest[site.count] == '_' || rest[site.count] == ',' || rest[site.count] == '\0'))
+            return true;
+    }
+    return false;
 }
 
-void scan_timestamp(uint8_t *target_var, uint8_t *buf, uint16_t *buf_pos)
+bool time_selected(const CTRDateTime *start)
 {
-    snprintf((char *)target_var, 13,
-             "%02d:%02d:%02d:%03d",
-             (uint8_t)buf[*buf_pos],
-             (uint8_t)buf[*buf_pos + 1],
-             (uint8_t)buf[*buf_pos + 2],
-             be16_to_cpu(buf + *buf_pos + 3));
-    *buf_pos = *buf_pos + 5;
+    int64_t minutes = ctr_date_time_minutes(start);
+    return minutes >= time_filter_from && minutes < time_filter_to;
 }
 
-int get_file_lenght(FILE *fp)
+/* --from/--to/--site check on the file name, files not following the standard name are kept */
+bool file_name_selected(const char *name)
 {
-    int lenght = 0;
-    fseek(fp, 0L, SEEK_END);
-    lenght = ftell(fp);
-    fseek(fp, 0L, SEEK_SET);
+    if (time_filter_from == INT64_MIN && time_filter_to == INT64_MAX && !site_filter_arg)
+        return true;
 
-    return lenght;
+    CTRDateTime start;
+    int rop_seconds;
+    const char *node;
+    if (!parse_ctr_file_name(name, &start, &rop_seconds, &node))
+        return true;
+
+    return time_selected(&start) && site_name_selected(node);
 }
 
-int get_file_pos(FILE *fp)
+/* --from/--to/--site confirmed on the header once the file is opened */
+bool header_selected(CTRHeader *header)
 {
-    return ftell(fp);
+    char node[256];
+
+    if (!time_selected(&header->date_time))
+        return false;
+    if (!site_filter_arg)
+        return true;
+
+    ctr_node_name((const char *)header->ne_logical_label, "", node, sizeof node);
+    if (site_selected(node))
+        return true;
+    ctr_node_name((const char *)header->ne_user_label, "", node, sizeof node);
+    return site_selected(node);
 }
 
-int read_header(CTRStruct *ptr, uint16_t len, FILE *fp)
+/* input files are regular *.bin files passing the file name filters */
+bool input_file_name_selected(const char *name)
 {
-    ptr->type = HEADER;
-    ptr->header.length = len;
-    scan_current_timestamp(ptr->header.parse_timestamp);
-
-    uint16_t buf_pos = 0;
-    uint8_t buf[len - 4]; // first 4 bytes of buf (type+length) already read from file
-    memset(buf, 0, len - 4);
+    const char *ext = strrchr(name, '.');
+    if ((!ext) || (ext == name))
+        return false;
 
-    if (fread(buf, 1, sizeof buf, fp) != sizeof buf)
-        return -1;
+    return strcmp(ext, ".bin") == 0 && file_name_selected(name);
+}
 
-    scan_string_from_buf(ptr->header.file_version, buf, &buf_pos, 5);
-    scan_string_from_buf(ptr->header.pm_version, buf, &buf_pos, 13);
-    scan_string_from_buf(ptr->header.pm_revision, buf, &buf_pos, 5);
-    scan_date(ptr->header.date, buf, &buf_pos); // read date but not move buf_pos
-    scan_rop(ptr->header.rop, buf, &buf_pos);   // read rop but not move buf_pos
-    scan_date_time(ptr->header.date_time, buf, &buf_pos);
-    scan_string_from_buf(ptr->header.ne_user_label, buf, &buf_pos, 128);
-    scan_string_from_buf(ptr->header.ne_logical_label, buf, &buf_pos, 255);
+typedef struct InputFile
+{
+    char *path;            // malloc'ed, owned by the caller of file_source_next
+    const char *file_name; // points into path
+} InputFile;
 
-    return EXIT_SUCCESS;
-}
+typedef struct InputFiles
+{
+    InputFile *items;
+    size_t count;
+    size_t capacity;
+} InputFiles;
 
-int read_scanner(CTRStruct *ptr, uint16_t len, FILE *fp)
+struct linux_dirent64
 {
-    ptr->type = SCANNER;
-    ptr->scanner.length = len;
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
 
-    uint16_t buf_pos = 0;
-    uint8_t buf[len - 4]; // first 4 bytes of buf (type+length) already read from file
-    memset(buf, 0, len - 4);
+#define DIR_BATCH_SIZE (64 * 1024)
+#define MAX_DIR_DEPTH 16
 
-    if (fread(buf, 1, sizeof buf, fp) != sizeof buf)
-        return -1;
+typedef struct DirStream
+{
+    int fd;
+    char *path;
+    char *buf; // DIR_BATCH_SIZE bytes of getdents64 output
+    long pos;
+    long end;
+} DirStream;
+
+/*
+ * Streaming enumeration of the input files: directory entries are read in
+ * getdents64 batches and handed out one at a time, so parsing starts while the
+ * directory is still being listed and memory does not grow with its size.
+ * With -R sub directories (e.g. per date) are walked too. Only with --sort the
+ * whole list is read and sorted by path first.
+ */
+typedef struct FileSource
+{
+    DirStream dirs[MAX_DIR_DEPTH];
+    int depth;
+    size_t next_root; // next of input_paths
+    FILE *file_list;  // --file-list, read one path per line
+    InputFiles sorted;
+    size_t next_sorted;
+} FileSource;
+
+bool file_source_push_dir(FileSource *src, const char *path)
+{
+    if (src->depth == MAX_DIR_DEPTH)
+    {
+        printf("[ WRN ]: Directory %s is nested too deep, skipped\n", path);
+        return false;
+    }
 
-    scan_timestamp(ptr->scanner.timestamp, buf, &buf_pos);
-    scan_bytes_from_buf(ptr->scanner.scannerid, buf, &buf_pos, 3);
-    scan_bytes_from_buf(ptr->scanner.status, buf, &buf_pos, 1);
-    scan_bytes_from_buf(ptr->scanner.padding, buf, &buf_pos, 2);
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+    {
+        printf("[ ERR ]: Opening the directory %s: %s\n", path, strerror(errno));
+        return false;
+    }
 
-    return EXIT_SUCCESS;
+    DirStream *dir = &src->dirs[src->depth++];
+    dir->fd = fd;
+    dir->path = strdup(path);
+    dir->buf = malloc(DIR_BATCH_SIZE);
+    dir->pos = dir->end = 0;
+    return true;
 }
 
-int read_event(CTRStruct *ptr, uint16_t len, FILE *fp)
+void file_source_pop_dir(FileSource *src)
 {
-    ptr->type = EVENT;
-    ptr->event.length = len;
+    DirStream *dir = &src->dirs[--src->depth];
+    close(dir->fd);
+    free(dir->path);
+    free(dir->buf);
+}
 
-    uint16_t buf_pos = 0;
-    uint8_t buf[len - 4]; // first 4 bytes of buf (type+length) already read from file
-    memset(buf, 0, len - 4);
+/* next of input_paths, then of the --file-list, NULL when both are done */
+char *file_source_next_root(FileSource *src)
+{
+    if (src->next_root < input_paths.count)
+        return strdup(input_paths.items[src->next_root++]);
 
-    if (fread(buf, 1, sizeof buf, fp) != sizeof buf)
-        return -1;
+    char *line = NULL;
+    size_t size = 0;
+    while (src->file_list != NULL && getline(&line, &size, src->file_list) >= 0)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0')
+            return line;
+    }
+    free(line);
+    return NULL;
+}
 
-    ptr->event.id = be32_to_cpu(buf);
-    buf_pos = buf_pos + 3;
+/* next file of the directory walk, false when it is done */
+bool file_source_walk(FileSource *src, InputFile *out)
+{
+    while (src->depth > 0 || src->next_root < input_paths.count || src->file_list != NULL)
+    {
+        if (src->depth == 0)
+        {
+            char *path = file_source_next_root(src);
+            struct stat st;
+            if (path == NULL)
+            {
+                if (src->file_list != NULL && src->file_list != stdin)
+                    fclose(src->file_list);
+                src->file_list = NULL;
+                continue;
+            }
+            if (stat(path, &st) != 0)
+            {
+                printf("[ ERR ]: Opening %s: %s\n", path, strerror(errno));
+                free(path);
+                continue;
+            }
+            if (S_ISDIR(st.st_mode))
+            {
+                file_source_push_dir(src, path);
+                free(path);
+                continue;
+            }
 
-    const char *event_name = get_pm_event_name_by_id(ptr->event.id);
-    strcpy(ptr->event.name, event_name);
+            /* files given explicitly are taken whatever their extension */
+            const char *slash = strrchr(path, '/');
+            out->path = path;
+            out->file_name = slash ? slash + 1 : path;
+            if (!file_name_selected(out->file_name))
+            {
+                free(path);
+                continue;
+            }
+            return true;
+        }
 
-    int event_parameter_size = len - buf_pos - 4;
-    uint8_t *event_parameters = malloc(event_parameter_size);
-    scan_bytes_from_buf(event_parameters, buf, &buf_pos, len - buf_pos - 4);
-    ptr->event.parameters = event_parameters;
+        DirStream *dir = &src->dirs[src->depth - 1];
+        if (dir->pos >= dir->end)
+        {
+            long n = syscall(SYS_getdents64, dir->fd, dir->buf, DIR_BATCH_SIZE);
+            if (n <= 0)
+            {
+                if (n < 0)
+                    printf("[ ERR ]: Reading the directory %s: %s\n", dir->path, strerror(errno));
+                file_source_pop_dir(src);
+                continue;
+            }
+            dir->pos = 0;
+            dir->end = n;
+        }
 
-    return EXIT_SUCCESS;
-}
+        struct linux_dirent64 *entry = (struct linux_dirent64 *)(dir->buf + dir->pos);
+        dir->pos += entry->d_reclen;
 
-int read_footer(CTRStruct *ptr, uint16_t len, FILE *fp)
-{
-    ptr->type = FOOTER;
-    ptr->event.length = len;
+        if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0')))
+            continue;
 
-    uint16_t buf_pos = 0;
-    uint8_t buf[len - 4]; // first 4 bytes of buf (type+length) already read from file
-    memset(buf, 0, len - 4);
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if (fstatat(dir->fd, entry->d_name, &st, 0) != 0)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
 
-    if (fread(buf, 1, sizeof buf, fp) != sizeof buf)
-        return -1;
+        if (type == DT_DIR && recursive_flag)
+        {
+            char *path = malloc(strlen(dir->path) + strlen(entry->d_name) + 2);
+            sprintf(path, "%s/%s", dir->path, entry->d_name);
+            file_source_push_dir(src, path);
+            free(path);
+            continue;
+        }
 
-    scan_date_time(ptr->footer.date_time, buf, &buf_pos);
-    scan_bytes_from_buf(ptr->footer.padding, buf, &buf_pos, 1);
+        if (type != DT_REG || !input_file_name_selected(entry->d_name))
+            continue;
 
-    return EXIT_SUCCESS;
+        out->path = malloc(strlen(dir->path) + strlen(entry->d_name) + 2); // + 2 because of the '/' and the terminating 0
+        sprintf(out->path, "%s/%s", dir->path, entry->d_name);
+        out->file_name = out->path + strlen(dir->path) + 1;
+        return true;
+    }
+    return false;
 }
 
-void read_record_len_type(uint16_t *len, uint16_t *type, FILE *fp)
+int compare_input_files(const void *a, const void *b)
 {
-    uint8_t buf[4];
+    return strcmp(((const InputFile *)a)->path, ((const InputFile *)b)->path);
+}
 
-    if (fread(buf, 1, sizeof buf, fp) != sizeof buf)
+bool file_source_open(FileSource *src)
+{
+    memset(src, 0, sizeof *src);
+    if (file_list_arg)
     {
-        printf("ERROR: Reading from file\n");
-        exit(EXIT_FAILURE);
+        src->file_list = strcmp(file_list_arg, "-") == 0 ? stdin : fopen(file_list_arg, "r");
+        if (src->file_list == NULL)
+        {
+            printf("[ ERR ]: Opening the file list %s: %s\n", file_list_arg, strerror(errno));
+            return false;
+        }
     }
 
-    *len = be16_to_cpu(buf);
-    if (*len <= 0)
+    if (sort_flag)
     {
-        printf("ERROR: Record lenght '%lu' not valid\n", (unsigned long)len);
-        exit(EXIT_FAILURE);
+        InputFile file;
+        while (file_source_walk(src, &file))
+            nob_da_append(&src->sorted, file);
+        qsort(src->sorted.items, src->sorted.count, sizeof(InputFile), compare_input_files);
     }
+    return true;
+}
 
-    *type = be16_to_cpu(buf + 2);
-    if (RecordTypeValid(*type) != 1)
+bool file_source_next(FileSource *src, InputFile *out)
+{
+    if (sort_flag)
     {
-        printf("ERROR: Record type '%lu' not known\n", (unsigned long)type);
-        exit(EXIT_FAILURE);
+        if (src->next_sorted == src->sorted.count)
+            return false;
+        *out = src->sorted.items[src->next_sorted++];
+        return true;
     }
+    return file_source_walk(src, out);
 }
 
-int free_events(CTRStruct *event)
+void file_source_close(FileSource *src)
 {
-    CTRStruct *next = NULL;
-    while (event->next != NULL)
+    while (src->depth > 0)
+        file_source_pop_dir(src);
+    if (src->file_list != NULL && src->file_list != stdin)
+        fclose(src->file_list);
+    for (size_t i = src->next_sorted; i < src->sorted.count; i++)
+        free(src->sorted.items[i].path);
+    nob_da_free(src->sorted);
+}
+
+#define MAX_PREFETCH 64
+#define PREFETCH_POOL_BYTES (256L * 1024 * 1024) // bytes of read ahead files held at once
+#define PREFETCH_MAX_FILE (64L * 1024 * 1024)    // larger files only get posix_fadvise(WILLNEED)
+
+#define DIRECT_IO_ALIGN 4096
+#define DIRECT_IO_CHUNK (4L * 1024 * 1024) // request size of the O_DIRECT reads
+
+typedef struct PrefetchItem
+{
+    InputFile input;
+    int fd;        // -1 when the file could not be opened (error holds errno)
+    int error;
+    uint8_t *data; // whole file when it was read ahead, NULL otherwise
+    size_t size;
+    int seq;       // position in input order, from 1
+} PrefetchItem;
+
+/*
+ * Prefetch stage between the file source and the parser: a thread opens the
+ * next files ahead of time and reads them into memory (bounded by count and
+ * PREFETCH_POOL_BYTES) or asks the kernel to read them ahead, so the parser
+ * does not wait on the first pages of each file. With --prefetch 0 files are
+ * opened by the parser thread itself.
+ */
+typedef struct Prefetcher
+{
+    FileSource *src;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    PrefetchItem items[MAX_PREFETCH];
+    int first;
+    int count;
+    int capacity;
+    size_t buffered_bytes; // read ahead bytes queued or still held by a decoder
+    int next_seq;
+    bool done;
+} Prefetcher;
+
+size_t direct_io_round(size_t size)
+{
+    return (size + DIRECT_IO_ALIGN - 1) & ~(size_t)(DIRECT_IO_ALIGN - 1);
+}
+
+void direct_io_unsupported(const char *path)
+{
+    static atomic_int warned;
+    if (atomic_exchange(&warned, 1) == 0)
+        printf("[ WRN ]: Direct I/O not supported for %s (%s), reading through the page cache\n", path, strerror(errno));
+}
+
+/* whole file into an aligned buffer with O_DIRECT, false when the file system does not support it */
+bool prefetch_read_direct(PrefetchItem *item)
+{
+    int fd = open(item->input.path, O_RDONLY | O_DIRECT);
+    if (fd < 0)
+        return false;
+
+    void *data;
+    size_t capacity = direct_io_round(item->size);
+    if (posix_memalign(&data, DIRECT_IO_ALIGN, capacity) != 0)
     {
-        /* switch (event->type)
-        {
-        case HEADER:
-            printf("[ INF ]: Free file Header Recordn");
-            free(event->header);
-            break;
-        case SCANNER:
-            printf("[ INF ]: Free file Header Recordn");
-            free(&event->header);
-            break;
-        case EVENT:
-            printf("[ INF ]: Free file Header Recordn");
-            free(&event->header);
-            break;
-        case FOOTER:
-            printf("[ INF ]: Free file Header Recordn");
-            free(&event->header);
+        close(fd);
+        return false;
+    }
+
+    size_t done = 0;
+    while (done < item->size)
+    {
+        size_t want = capacity - done;
+        if (want > DIRECT_IO_CHUNK)
+            want = DIRECT_IO_CHUNK;
+        ssize_t n = pread(fd, (uint8_t *)data + done, want, done);
+        if (n <= 0)
             break;
-        } */
+        done += n;
+        if (done % DIRECT_IO_ALIGN != 0)
+            break; // end of file
+    }
+    close(fd);
 
-        next = event->next;
-        printf("[ INF ]: Free event file id %d\n", event->file_id);
-        free(event);
-        event = next;
+    if (done < item->size)
+    {
+        free(data);
+        return false;
     }
-    return EXIT_SUCCESS;
+    item->data = data;
+    return true;
 }
 
-CTRStruct *add_record(int id, uint16_t type, uint16_t lenght, FILE *fp, int file_id)
+/*
+ * FILE reading a file too large to be read ahead with O_DIRECT, DIRECT_IO_CHUNK
+ * bytes at a time. Seeks only move the position, the parser skips records
+ * with fseek.
+ */
+typedef struct DirectStream
 {
-    CTRStruct *new_node = malloc(sizeof(CTRStruct));
-    memset(new_node, 0, sizeof(CTRStruct));
-
-    new_node->file_id = file_id;
-    new_node->record_id = id;
+    int fd;
+    uint8_t *buf;
+    off_t buf_offset; // file offset of buf, aligned
+    size_t buf_len;
+    off_t pos;
+    off_t size;
+} DirectStream;
+
+ssize_t direct_stream_read(void *cookie, char *out, size_t n)
+{
+    DirectStream *ds = cookie;
+    size_t copied = 0;
 
-    switch (type)
+    while (copied < n && ds->pos < ds->size)
     {
-    case HEADER:
-        read_header(new_node, lenght, fp);
-        return new_node;
-    case SCANNER:
-        read_scanner(new_node, lenght, fp);
-        return new_node;
-    case EVENT:
-        read_event(new_node, lenght, fp);
-        return new_node;
-    case FOOTER:
-        read_footer(new_node, lenght, fp);
-        return new_node;
-    default:
-        printf("Record type not known");
-        return NULL;
+        if (ds->pos < ds->buf_offset || ds->pos >= ds->buf_offset + (off_t)ds->buf_len)
+        {
+            ds->buf_offset = ds->pos & ~(off_t)(DIRECT_IO_ALIGN - 1);
+            ssize_t r = pread(ds->fd, ds->buf, DIRECT_IO_CHUNK, ds->buf_offset);
+            ds->buf_len = r > 0 ? r : 0;
+            if (r < 0)
+                return copied > 0 ? (ssize_t)copied : -1;
+            if (ds->pos >= ds->buf_offset + r)
+                break;
+        }
+
+        size_t avail = ds->buf_offset + ds->buf_len - ds->pos;
+        if (avail > n - copied)
+            avail = n - copied;
+        memcpy(out + copied, ds->buf + (ds->pos - ds->buf_offset), avail);
+        copied += avail;
+        ds->pos += avail;
     }
+    return copied;
 }
 
-void print_header(CTRStruct *ptr)
+int direct_stream_seek(void *cookie, off64_t *offset, int whence)
+{
+    DirectStream *ds = cookie;
+    off_t pos = *offset;
+
+    if (whence == SEEK_CUR)
+        pos += ds->pos;
+    else if (whence == SEEK_END)
+        pos += ds->size;
+    if (pos < 0)
+        return -1;
+    ds->pos = pos;
+    *offset = pos;
+    return 0;
+}
+
+int direct_stream_close(void *cookie)
+{
+    DirectStream *ds = cookie;
+    close(ds->fd);
+    free(ds->buf);
+    free(ds);
+    return 0;
+}
+
+FILE *direct_stream_open(PrefetchItem *item)
+{
+    int fd = open(item->input.path, O_RDONLY | O_DIRECT);
+    if (fd < 0)
+        return NULL;
+
+    DirectStream *ds = calloc(1, sizeof *ds);
+    ds->fd = fd;
+    ds->size = item->size;
+    if (posix_memalign((void **)&ds->buf, DIRECT_IO_ALIGN, DIRECT_IO_CHUNK) != 0)
+    {
+        close(fd);
+        free(ds);
+        return NULL;
+    }
+
+    cookie_io_functions_t io = {
+        .read = direct_stream_read,
+        .seek = direct_stream_seek,
+        .close = direct_stream_close,
+    };
+    FILE *file = fopencookie(ds, "rb", io);
+    if (file == NULL)
+        direct_stream_close(ds);
+    return file;
+}
+
+void prefetch_open(PrefetchItem *item, bool read_ahead)
+{
+    struct stat st;
+
+    item->data = NULL;
+    item->size = 0;
+    item->error = 0;
+    item->fd = open(item->input.path, O_RDONLY);
+    if (item->fd < 0 || fstat(item->fd, &st) != 0)
+    {
+        item->error = errno;
+        return;
+    }
+    item->size = st.st_size;
+
+    if (!read_ahead)
+        return;
+
+    if (item->size == 0 || (long)item->size > PREFETCH_MAX_FILE)
+    {
+        if (!direct_io_flag) // read later through a DirectStream
+            posix_fadvise(item->fd, 0, 0, POSIX_FADV_WILLNEED);
+        return;
+    }
+
+    if (direct_io_flag)
+    {
+        if (prefetch_read_direct(item))
+        {
+            close(item->fd);
+            item->fd = -1;
+            return;
+        }
+        direct_io_unsupported(item->input.path);
+    }
+
+    item->data = malloc(item->size);
+    size_t done = 0;
+    while (done < item->size)
+    {
+        ssize_t n = read(item->fd, item->data + done, item->size - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+
+    if (done != item->size)
+    {
+        free(item->data);
+        item->data = NULL;
+        lseek(item->fd, 0, SEEK_SET);
+        return;
+    }
+    if (direct_io_flag)
+        posix_fadvise(item->fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(item->fd);
+    item->fd = -1;
+}
+
+/* wait for room for bytes more of read ahead data, a file larger than the pool only waits for it to empty */
+void prefetch_reserve(Prefetcher *pf, size_t bytes)
+{
+    pthread_mutex_lock(&pf->lock);
+    while (pf->buffered_bytes > 0 && pf->buffered_bytes + bytes > PREFETCH_POOL_BYTES)
+        pthread_cond_wait(&pf->not_full, &pf->lock);
+    pf->buffered_bytes += bytes;
+    pthread_mutex_unlock(&pf->lock);
+}
+
+/* take bytes from the pool only if they fit now, false otherwise */
+bool prefetch_try_reserve(Prefetcher *pf, size_t bytes)
+{
+    pthread_mutex_lock(&pf->lock);
+    bool fits = pf->buffered_bytes + bytes <= PREFETCH_POOL_BYTES;
+    if (fits)
+        pf->buffered_bytes += bytes;
+    pthread_mutex_unlock(&pf->lock);
+    return fits;
+}
+
+void prefetch_unreserve(Prefetcher *pf, size_t bytes)
+{
+    pthread_mutex_lock(&pf->lock);
+    pf->buffered_bytes -= bytes;
+    pthread_cond_broadcast(&pf->not_full);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+/* hand an opened file to the parser, reserved is what prefetch_reserve took for it */
+void prefetch_push(Prefetcher *pf, PrefetchItem *item, size_t reserved)
+{
+    pthread_mutex_lock(&pf->lock);
+    while (pf->count == pf->capacity)
+        pthread_cond_wait(&pf->not_full, &pf->lock);
+    pf->buffered_bytes = pf->buffered_bytes - reserved + (item->data ? item->size : 0);
+    pf->items[(pf->first + pf->count) % pf->capacity] = *item;
+    pf->count++;
+    pthread_cond_signal(&pf->not_empty);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+/*
+ * io_uring input for many small files: the opens and statx calls of a batch of
+ * files go to the kernel in one io_uring_enter, then all their reads, then all
+ * the closes, instead of 4 syscalls per file. Only the raw kernel interface is
+ * used (no liburing); when io_uring_setup fails or an op is not supported the
+ * prefetcher falls back to prefetch_open.
+ */
+#define URING_BATCH 32
+
+typedef struct Uring
+{
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned to_submit;
+    unsigned in_flight; // submitted, completion not reaped yet
+} Uring;
+
+bool uring_init(Uring *ring, unsigned entries)
+{
+    struct io_uring_params params = {0};
+
+    memset(ring, 0, sizeof *ring);
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return false;
+
+    ring->entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP)
+                        ? ring->sq_ring
+                        : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        close(ring->fd);
+        return false;
+    }
+
+    uint8_t *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+void uring_free(Uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring, uint8_t opcode, uint64_t user_data)
+{
+    unsigned tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries)
+        return NULL;
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = opcode;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    return sqe;
+}
+
+/* reap the completions of everything submitted, calling done for each */
+bool uring_wait(Uring *ring, void (*done)(void *ctx, uint64_t user_data, int res), void *ctx)
+{
+    while (ring->in_flight > 0)
+    {
+        unsigned head = *ring->cq_head;
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+                return false;
+            continue;
+        }
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        done(ctx, cqe->user_data, cqe->res);
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+        ring->in_flight--;
+    }
+    return true;
+}
+
+/* submit the queued sqes and wait for their completions; on false the submitted
+ * ones may still be in flight (see in_flight) and the rest were never started */
+bool uring_run(Uring *ring, void (*done)(void *ctx, uint64_t user_data, int res), void *ctx)
+{
+    while (ring->to_submit > 0)
+    {
+        int n = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 0, 0, NULL, 0);
+        if (n < 0 && errno != EINTR)
+            return false;
+        if (n > 0)
+        {
+            ring->to_submit -= n;
+            ring->in_flight += n;
+        }
+    }
+    return uring_wait(ring, done, ctx);
+}
+
+enum UringOp
+{
+    URING_OPEN,
+    URING_STATX,
+    URING_READ,
+    URING_CLOSE,
+};
+
+typedef struct UringBatch
+{
+    PrefetchItem items[URING_BATCH];
+    struct statx stx[URING_BATCH];
+    size_t reserved[URING_BATCH]; // pool bytes taken for the item
+    int n;
+    bool unsupported; // the kernel does not know one of the ops
+} UringBatch;
+
+void uring_batch_done(void *ctx, uint64_t user_data, int res)
+{
+    UringBatch *batch = ctx;
+    PrefetchItem *item = &batch->items[user_data & 0xffffffff];
+
+    if (res == -EINVAL || res == -EOPNOTSUPP)
+        batch->unsupported = true;
+
+    switch (user_data >> 32)
+    {
+    case URING_OPEN:
+        item->fd = res;
+        if (res < 0)
+            item->error = -res;
+        break;
+    case URING_STATX:
+        if (res < 0 && item->error == 0)
+            item->error = -res;
+        break;
+    case URING_READ:
+        if (res < 0 || (size_t)res != item->size)
+        {
+            free(item->data); // short read, left to the regular path
+            item->data = NULL;
+        }
+        break;
+    case URING_CLOSE:
+        break;
+    }
+}
+
+/* drop the fds, buffers and pool bytes of a batch that falls back to regular reads;
+ * with ops of the ring still in flight the buffers are left to the kernel */
+void uring_batch_release(Prefetcher *pf, Uring *ring, UringBatch *batch)
+{
+    for (int i = 0; i < batch->n; i++)
+    {
+        PrefetchItem *item = &batch->items[i];
+        if (item->fd >= 0)
+            close(item->fd);
+        item->fd = -1;
+        if (ring->in_flight == 0)
+            free(item->data);
+        item->data = NULL;
+        if (batch->reserved[i] > 0)
+            prefetch_unreserve(pf, batch->reserved[i]);
+        batch->reserved[i] = 0;
+    }
+}
+
+/* failed batch: reap what can still complete, so opened fds are known, then release it */
+bool uring_batch_fail(Prefetcher *pf, Uring *ring, UringBatch *batch)
+{
+    uring_wait(ring, uring_batch_done, batch);
+    uring_batch_release(pf, ring, batch);
+    return false;
+}
+
+/* open, size, read and close the files of a batch with 3 io_uring_enter rounds */
+bool prefetch_batch_uring(Prefetcher *pf, Uring *ring, UringBatch *batch)
+{
+    for (int i = 0; i < batch->n; i++)
+    {
+        PrefetchItem *item = &batch->items[i];
+        item->fd = -1;
+        item->error = 0;
+        item->data = NULL;
+        item->size = 0;
+        batch->reserved[i] = 0;
+    }
+    for (int i = 0; i < batch->n; i++)
+    {
+        PrefetchItem *item = &batch->items[i];
+        struct io_uring_sqe *sqe = uring_get_sqe(ring, IORING_OP_OPENAT, ((uint64_t)URING_OPEN << 32) | i);
+        if (sqe == NULL)
+            return uring_batch_fail(pf, ring, batch);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)item->input.path;
+        sqe->open_flags = direct_io_flag ? O_RDONLY | O_DIRECT : O_RDONLY;
+
+        sqe = uring_get_sqe(ring, IORING_OP_STATX, ((uint64_t)URING_STATX << 32) | i);
+        if (sqe == NULL)
+            return uring_batch_fail(pf, ring, batch);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)item->input.path;
+        sqe->len = STATX_SIZE;
+        sqe->off = (uint64_t)(uintptr_t)&batch->stx[i];
+    }
+    if (!uring_run(ring, uring_batch_done, batch) || batch->unsupported)
+        return uring_batch_fail(pf, ring, batch);
+
+    // pool bytes per file: the first waits like the regular path, the rest of the
+    // batch only gets a buffer while it fits and is read through the fd otherwise
+    bool waited = false;
+    for (int i = 0; i < batch->n; i++)
+    {
+        PrefetchItem *item = &batch->items[i];
+        if (item->error == 0)
+            item->size = batch->stx[i].stx_size;
+        if (item->error != 0 || item->size == 0 || (long)item->size > PREFETCH_MAX_FILE)
+            continue;
+
+        if (!waited)
+            prefetch_reserve(pf, item->size);
+        else if (!prefetch_try_reserve(pf, item->size))
+            continue;
+        waited = true;
+        batch->reserved[i] = item->size;
+
+        size_t len = direct_io_flag ? direct_io_round(item->size) : item->size;
+        struct io_uring_sqe *sqe = NULL;
+        if (posix_memalign((void **)&item->data, DIRECT_IO_ALIGN, len) != 0 ||
+            (sqe = uring_get_sqe(ring, IORING_OP_READ, ((uint64_t)URING_READ << 32) | i)) == NULL)
+        {
+            free(item->data);
+            item->data = NULL;
+            continue;
+        }
+        sqe->fd = item->fd;
+        sqe->addr = (uint64_t)(uintptr_t)item->data;
+        sqe->len = len;
+        sqe->off = 0;
+    }
+    if (!uring_run(ring, uring_batch_done, batch))
+        return uring_batch_fail(pf, ring, batch);
+
+    for (int i = 0; i < batch->n; i++)
+    {
+        PrefetchItem *item = &batch->items[i];
+        if (item->data == NULL)
+        {
+            if (item->fd >= 0)
+                posix_fadvise(item->fd, 0, 0, POSIX_FADV_WILLNEED);
+            continue;
+        }
+
+        struct io_uring_sqe *sqe = uring_get_sqe(ring, IORING_OP_CLOSE, ((uint64_t)URING_CLOSE << 32) | i);
+        if (sqe == NULL)
+            close(item->fd);
+        else
+            sqe->fd = item->fd;
+        item->fd = -1;
+    }
+    uring_run(ring, uring_batch_done, batch);
+
+    for (int i = 0; i < batch->n; i++)
+        prefetch_push(pf, &batch->items[i], batch->reserved[i]);
+    return true;
+}
+
+/* read ahead one file with regular reads, within the pool */
+void prefetch_file(Prefetcher *pf, PrefetchItem *item)
+{
+    struct stat st;
+    size_t size = stat(item->input.path, &st) == 0 ? st.st_size : 0;
+    if ((long)size > PREFETCH_MAX_FILE)
+        size = 0;
+
+    prefetch_reserve(pf, size);
+    prefetch_open(item, true);
+    prefetch_push(pf, item, size);
+}
+
+/* the io_uring path of the prefetch thread, false when io_uring can not be used */
+bool prefetch_worker_uring(Prefetcher *pf)
+{
+    Uring ring;
+    if (!uring_init(&ring, 2 * URING_BATCH))
+    {
+        printf("[ WRN ]: io_uring not available (%s), using regular reads\n", strerror(errno));
+        return false;
+    }
+
+    UringBatch *batch = malloc(sizeof *batch);
+    bool ok = true;
+    for (;;)
+    {
+        batch->n = 0;
+        batch->unsupported = false;
+        while (batch->n < URING_BATCH && file_source_next(pf->src, &batch->items[batch->n].input))
+            batch->n++;
+        if (batch->n == 0)
+            break;
+
+        if (!prefetch_batch_uring(pf, &ring, batch))
+        {
+            printf("[ WRN ]: io_uring ops not supported, using regular reads\n");
+            for (int i = 0; i < batch->n; i++)
+            {
+                if (ring.in_flight > 0) // an open may still read the path
+                    batch->items[i].input.path = strdup(batch->items[i].input.path);
+                prefetch_file(pf, &batch->items[i]);
+            }
+            ok = false;
+            break;
+        }
+    }
+
+    if (ring.in_flight == 0)
+        free(batch); // else the kernel may still write its statx buffers
+    uring_free(&ring);
+    return ok;
+}
+
+void *prefetch_worker(void *arg)
+{
+    Prefetcher *pf = arg;
+    PrefetchItem item;
+
+    if (io_uring_flag)
+        prefetch_worker_uring(pf);
+
+    while (file_source_next(pf->src, &item.input))
+        prefetch_file(pf, &item);
+
+    pthread_mutex_lock(&pf->lock);
+    pf->done = true;
+    pthread_cond_broadcast(&pf->not_empty); // every decoder thread may be waiting
+    pthread_mutex_unlock(&pf->lock);
+    return NULL;
+}
+
+void prefetch_start(Prefetcher *pf, FileSource *src, int depth)
+{
+    memset(pf, 0, sizeof *pf);
+    pf->src = src;
+    pf->capacity = depth > MAX_PREFETCH ? MAX_PREFETCH : depth;
+    pthread_mutex_init(&pf->lock, NULL);
+    if (pf->capacity <= 0)
+        return;
+
+    pthread_cond_init(&pf->not_empty, NULL);
+    pthread_cond_init(&pf->not_full, NULL);
+    pthread_create(&pf->thread, NULL, prefetch_worker, pf);
+}
+
+/* next opened file in input order, false when there are no more; safe to call from several threads */
+bool prefetch_next(Prefetcher *pf, PrefetchItem *item)
+{
+    if (pf->capacity <= 0)
+    {
+        pthread_mutex_lock(&pf->lock);
+        bool found = file_source_next(pf->src, &item->input);
+        item->seq = ++pf->next_seq;
+        pthread_mutex_unlock(&pf->lock);
+        if (!found)
+            return false;
+        prefetch_open(item, false);
+        return true;
+    }
+
+    pthread_mutex_lock(&pf->lock);
+    while (pf->count == 0 && !pf->done)
+        pthread_cond_wait(&pf->not_empty, &pf->lock);
+    if (pf->count == 0)
+    {
+        pthread_mutex_unlock(&pf->lock);
+        return false;
+    }
+    *item = pf->items[pf->first];
+    item->seq = ++pf->next_seq;
+    pf->first = (pf->first + 1) % pf->capacity;
+    pf->count--;
+    pthread_cond_signal(&pf->not_full); // a slot is free, whether or not the item holds a buffer
+    pthread_mutex_unlock(&pf->lock);
+    return true;
+}
+
+/* FILE over the read ahead bytes, or over the file itself */
+FILE *prefetch_fopen(PrefetchItem *item)
+{
+    if (item->data != NULL)
+        return fmemopen(item->data, item->size, "rb");
+
+    if (direct_io_flag && item->size > 0)
+    {
+        FILE *file = direct_stream_open(item);
+        if (file != NULL)
+            return file;
+        direct_io_unsupported(item->input.path);
+    }
+
+    FILE *file = fdopen(item->fd, "rb");
+    if (file != NULL)
+        item->fd = -1; // closed with the FILE
+    return file;
+}
+
+/* close the parsed file, with --direct-io its pages are dropped if it was read through the cache */
+void prefetch_fclose(PrefetchItem *item, FILE *file)
+{
+    if (direct_io_flag && item->data == NULL && fileno(file) >= 0)
+        posix_fadvise(fileno(file), 0, 0, POSIX_FADV_DONTNEED);
+    fclose(file);
+}
+
+void prefetch_release(Prefetcher *pf, PrefetchItem *item)
+{
+    if (item->fd >= 0)
+        close(item->fd);
+    free(item->input.path);
+    if (item->data == NULL)
+        return;
+
+    free(item->data);
+    if (pf->capacity > 0)
+    {
+        pthread_mutex_lock(&pf->lock);
+        pf->buffered_bytes -= item->size;
+        pthread_cond_broadcast(&pf->not_full); // the prefetcher may wait on bytes
+        pthread_mutex_unlock(&pf->lock);
+    }
+}
+
+void prefetch_stop(Prefetcher *pf)
+{
+    if (pf->capacity > 0)
+    {
+        pthread_join(pf->thread, NULL);
+        pthread_cond_destroy(&pf->not_empty);
+        pthread_cond_destroy(&pf->not_full);
+    }
+    pthread_mutex_destroy(&pf->lock);
+}
+
+/*
+ * Bounded lock-free multi producer / multi consumer queue (Vyukov): every cell
+ * carries a sequence number telling whether it is free for the producer of
+ * round tail or holds the value for the consumer of round head. A full queue
+ * makes the producer wait, which is the backpressure between stages.
+ */
+#define CACHE_LINE 64
+
+typedef struct QueueCell
+{
+    atomic_size_t seq;
+    void *data;
+} QueueCell;
+
+typedef struct Queue
+{
+    QueueCell *cells;
+    size_t mask;
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+} Queue;
+
+void queue_init(Queue *q, size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+
+    q->cells = malloc(size * sizeof(QueueCell));
+    q->mask = size - 1;
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&q->cells[i].seq, i);
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+}
+
+void queue_free(Queue *q)
+{
+    free(q->cells);
+}
+
+bool queue_try_push(Queue *q, void *data)
+{
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;)
+    {
+        QueueCell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                cell->data = data;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+            return false; // full
+        else
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+}
+
+bool queue_try_pop(Queue *q, void **data)
+{
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;)
+    {
+        QueueCell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                *data = cell->data;
+                atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+            return false; // empty
+        else
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+}
+
+/* spin a little, then yield, then sleep up to 1 ms: stages are not busy waiting on a slow neighbour */
+void queue_backoff(int *spins)
+{
+    if (*spins < 64)
+        ;
+    else if (*spins < 128)
+        sched_yield();
+    else
+    {
+        struct timespec ts = {0, *spins < 1024 ? 50 * 1000 : 1000 * 1000};
+        nanosleep(&ts, NULL);
+    }
+    (*spins)++;
+}
+
+void queue_push(Queue *q, void *data)
+{
+    int spins = 0;
+    while (!queue_try_push(q, data))
+        queue_backoff(&spins);
+}
+
+void *queue_pop(Queue *q)
+{
+    void *data;
+    int spins = 0;
+    while (!queue_try_pop(q, &data))
+        queue_backoff(&spins);
+    return data;
+}
+
+void scan_string_from_buf(uint8_t *target_var, uint8_t *buf, uint16_t *buf_pos, uint16_t size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        target_var[i] = buf[*buf_pos + i];
+    }
+    target_var[size + 1] = '\0';
+    *buf_pos = *buf_pos + size;
+}
+
+void scan_bytes_from_buf(uint8_t *target_var, uint8_t *buf, uint16_t *buf_pos, uint16_t size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        target_var[i] = buf[*buf_pos + i];
+    }
+    *buf_pos = *buf_pos + size;
+}
+
+void scan_date_time(CTRDateTime *target_var, uint8_t *buf, uint16_t *buf_pos)
+{
+    target_var->year = be16_to_cpu(buf + *buf_pos);
+    target_var->month = buf[*buf_pos + 2];
+    target_var->day = buf[*buf_pos + 3];
+    target_var->hour = buf[*buf_pos + 4];
+    target_var->minute = buf[*buf_pos + 5];
+    target_var->second = buf[*buf_pos + 6];
+    *buf_pos = *buf_pos + 7;
+}
+
+void scan_timestamp(CTRTime *target_var, uint8_t *buf, uint16_t *buf_pos)
+{
+    target_var->hour = buf[*buf_pos];
+    target_var->minute = buf[*buf_pos + 1];
+    target_var->second = buf[*buf_pos + 2];
+    target_var->millisecond = be16_to_cpu(buf + *buf_pos + 3);
+    *buf_pos = *buf_pos + 5;
+}
+
+/* "00" "01" ... "99", two digits per value so formatting is a table copy instead of snprintf */
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* write value % 100 as 2 digits, returns the position after them */
+char *format_2digits(char *out, unsigned int value)
+{
+    memcpy(out, digit_pairs + (value % 100) * 2, 2);
+    return out + 2;
+}
+
+/* yyyymmdd */
+char *format_date(char *out, const CTRDateTime *dt)
+{
+    char *p = out;
+    p = format_2digits(p, dt->year / 100);
+    p = format_2digits(p, dt->year);
+    p = format_2digits(p, dt->month);
+    p = format_2digits(p, dt->day);
+    *p = '\0';
+    return out;
+}
+
+/* hhmm */
+char *format_rop(char *out, const CTRDateTime *dt)
+{
+    char *p = out;
+    p = format_2digits(p, dt->hour);
+    p = format_2digits(p, dt->minute);
+    *p = '\0';
+    return out;
+}
+
+/* yyyy-mm-dd hh:mm:ss */
+char *format_date_time(char *out, const CTRDateTime *dt)
+{
+    char *p = out;
+    p = format_2digits(p, dt->year / 100);
+    p = format_2digits(p, dt->year);
+    *p++ = '-';
+    p = format_2digits(p, dt->month);
+    *p++ = '-';
+    p = format_2digits(p, dt->day);
+    *p++ = ' ';
+    p = format_2digits(p, dt->hour);
+    *p++ = ':';
+    p = format_2digits(p, dt->minute);
+    *p++ = ':';
+    p = format_2digits(p, dt->second);
+    *p = '\0';
+    return out;
+}
+
+/* hh:mm:ss:mmm */
+char *format_time(char *out, const CTRTime *t)
+{
+    char *p = out;
+    p = format_2digits(p, t->hour);
+    *p++ = ':';
+    p = format_2digits(p, t->minute);
+    *p++ = ':';
+    p = format_2digits(p, t->second);
+    *p++ = ':';
+    *p++ = '0' + (t->millisecond / 100) % 10;
+    p = format_2digits(p, t->millisecond);
+    *p = '\0';
+    return out;
+}
+
+typedef struct BitReader
+{
+    const uint8_t *buf;
+    uint32_t size; // in bits
+    uint32_t pos;  // in bits
+} BitReader;
+
+typedef struct CTRParamValue
+{
+    bool valid;       // false when flagged unavailable or when it runs past the record
+    uint64_t value;   // PARAM_UINT value
+    uint32_t bit_pos; // PARAM_BYTES/PARAM_BYTEARRAY start of the bytes
+    uint16_t length;  // PARAM_BYTES/PARAM_BYTEARRAY number of bytes
+} CTRParamValue;
+
+/* read n (<= 64) bits, most significant bit first */
+uint64_t read_bits(BitReader *br, int n)
+{
+    uint64_t value = 0;
+
+    if (br->pos + n > br->size)
+    {
+        br->pos = br->size + 1; // mark overrun
+        return 0;
+    }
+
+    while (n > 0)
+    {
+        int bit = br->pos & 7;
+        int take = 8 - bit;
+        if (take > n)
+            take = n;
+
+        uint8_t bits = (br->buf[br->pos >> 3] >> (8 - bit - take)) & ((1 << take) - 1);
+        value = (value << take) | bits;
+        br->pos += take;
+        n -= take;
+    }
+
+    return value;
+}
+
+/* Decode the param at the reader position into out and advance past it. With
+ * out == NULL the param is only skipped: fixed size params just move the bit
+ * position and byte arrays only read their length. */
+void decode_pm_event_param(BitReader *br, ParamsList *param, CTRParamValue *out)
+{
+    bool valid = true;
+
+    if (param->unavailable_flag)
+        valid = read_bits(br, 1) == 0;
+
+    switch (param->kind)
+    {
+    case PARAM_UINT:
+        if (out == NULL)
+        {
+            br->pos += param->size;
+            break;
+        }
+        out->value = read_bits(br, param->size);
+        break;
+    case PARAM_BYTES:
+        if (out != NULL)
+        {
+            out->bit_pos = br->pos;
+            out->length = param->size / 8;
+        }
+        br->pos += param->size;
+        break;
+    case PARAM_BYTEARRAY:
+    {
+        uint16_t length = read_bits(br, 16);
+        if (out != NULL)
+        {
+            out->bit_pos = br->pos;
+            out->length = length;
+        }
+        br->pos += length * 8;
+        break;
+    }
+    }
+
+    if (out != NULL)
+        out->valid = valid && br->pos <= br->size;
+}
+
+/* Decode a single param of an event straight from the raw event parameters,
+ * jumping to its fixed offset when it has one instead of walking the list. */
+bool find_pm_event_param_value(EventConfig *event, ParamsList *param, const uint8_t *params, uint16_t params_len, CTRParamValue *out)
+{
+    BitReader br = {.buf = params, .size = params_len * 8, .pos = 0};
+    memset(out, 0, sizeof *out);
+
+    if (param->bit_offset >= 0)
+    {
+        br.pos = param->bit_offset;
+    }
+    else
+    {
+        ParamsList *p = event->params_head;
+        while (p != NULL && p != param && br.pos <= br.size)
+        {
+            decode_pm_event_param(&br, p, NULL);
+            p = p->next;
+        }
+        if (p != param)
+            return false;
+    }
+
+    decode_pm_event_param(&br, param, out);
+    return out->valid;
+}
+
+/* select a param of an event for the --columns output */
+void select_pm_event_column(EventConfig *event, ParamsList *param)
+{
+    if (param->column >= 0)
+        return;
+
+    param->column = 0;
+    event->n_columns = 0;
+    for (ParamsList *p = event->params_head; p != NULL; p = p->next)
+    {
+        if (p->column < 0)
+            continue;
+        p->column = event->n_columns++;
+        event->last_column = p;
+    }
+}
+
+/*
+ * --columns spec: ';' separated list of EVENT:PARAM,PARAM,... where EVENT is an
+ * event name or id and a PARAM of '*' selects all params of the event. An EVENT of
+ * '*' applies the param list to every event in the config, e.g.
+ *     --columns 'INTERNAL_PROC_RRC_CONN_SETUP:EVENT_PARAM_GLOBAL_CELL_ID,EVENT_PARAM_RESULT'
+ *     --columns '*:*'
+ * Only the selected params are decoded, the rest are skipped over.
+ */
+int resolve_event_columns(const char *arg)
+{
+    Nob_String_View specs = nob_sv_from_cstr(arg);
+    int selected = 0;
+
+    while (specs.count > 0)
+    {
+        Nob_String_View spec = nob_sv_trim(nob_sv_chop_by_delim(&specs, ';'));
+        if (spec.count == 0)
+            continue;
+
+        const char *event_cstr = nob_temp_sv_to_cstr(nob_sv_trim(nob_sv_chop_by_delim(&spec, ':')));
+        Nob_String_View params = nob_sv_trim(spec);
+
+        EventConfig *target = NULL, *event, *tmp;
+        bool all_events = strcmp(event_cstr, "*") == 0;
+        if (!all_events)
+        {
+            char *end = NULL;
+            long id = strtol(event_cstr, &end, 10);
+            target = (*end == '\0') ? find_pm_event((int)id) : find_pm_event_by_name(event_cstr);
+            if (target == NULL)
+            {
+                printf("[ WRN ]: Columns event '%s' not found in config\n", event_cstr);
+                continue;
+            }
+        }
+
+        while (params.count > 0)
+        {
+            const char *param_cstr = nob_temp_sv_to_cstr(nob_sv_trim(nob_sv_chop_by_delim(&params, ',')));
+            bool all_params = strcmp(param_cstr, "*") == 0;
+            bool found = false;
+
+            HASH_ITER(hh, event_hash, event, tmp)
+            {
+                if (!all_events && event != target)
+                    continue;
+
+                for (ParamsList *param = event->params_head; param != NULL; param = param->next)
+                {
+                    if (!all_params && strcmp(param->name, param_cstr) != 0)
+                        continue;
+                    if (param->column < 0)
+                        selected++;
+                    select_pm_event_column(event, param);
+                    found = true;
+                }
+            }
+
+            if (!found)
+                printf("[ WRN ]: Columns param '%s' not found for event '%s'\n", param_cstr, event_cstr);
+        }
+    }
+    nob_temp_reset();
+
+    printf("[ CFG ]: Columns set to %d event params\n", selected);
+
+    return selected;
+}
+
+/* decode the raw EVENT_PARAM_TIMESTAMP_* params of an event */
+bool decode_pm_event_timestamp(EventConfig *event, const uint8_t *params, uint16_t params_len, CTRTime *out)
+{
+    CTRParamValue value[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (event->timestamp_params[i] == NULL)
+            return false;
+        find_pm_event_param_value(event, event->timestamp_params[i], params, params_len, &value[i]);
+    }
+
+    out->hour = value[0].value;
+    out->minute = value[1].value;
+    out->second = value[2].value;
+    out->millisecond = value[3].value;
+    return true;
+}
+
+/* Decode the --columns of an event into values (one per column). Params that are
+ * not selected are skipped and nothing after the last selected param is touched. */
+void decode_pm_event_columns(EventConfig *event, const uint8_t *params, uint16_t params_len, CTRParamValue *values)
+{
+    BitReader br = {.buf = params, .size = params_len * 8, .pos = 0};
+
+    for (ParamsList *param = event->params_head; param != NULL && br.pos <= br.size; param = param->next)
+    {
+        if (param->column < 0)
+        {
+            decode_pm_event_param(&br, param, NULL);
+            continue;
+        }
+
+        if (param->bit_offset >= 0)
+            br.pos = param->bit_offset;
+        decode_pm_event_param(&br, param, &values[param->column]);
+
+        if (param == event->last_column)
+            break;
+    }
+}
+
+/*
+ * -w/--where filter expression over event parameter names, e.g.
+ *     EVENT_PARAM_GLOBAL_CELL_ID == 1001 && (EVENT_PARAM_RAC_UE_REF == 5 || !EVENT_PARAM_RESULT)
+ * Operators: == != < <= > >= && || ! and parentheses, values are integers.
+ * A param on its own is true when it is present, valid and non zero. A comparison
+ * on a param that the event does not have or that is not available is false.
+ */
+enum FilterOp
+{
+    FILTER_PARAM,
+    FILTER_CMP,
+    FILTER_NOT,
+    FILTER_AND,
+    FILTER_OR,
+};
+
+enum FilterCmp
+{
+    CMP_EQ,
+    CMP_NE,
+    CMP_LT,
+    CMP_LE,
+    CMP_GT,
+    CMP_GE,
+};
+
+typedef struct FilterNode
+{
+    enum FilterOp op;
+    enum FilterCmp cmp;
+    int slot;       // FILTER_PARAM/FILTER_CMP: index in filter_slot_names
+    uint64_t value; // FILTER_CMP
+    struct FilterNode *lhs, *rhs;
+} FilterNode;
+
+#define MAX_FILTER_SLOTS 32
+
+FilterNode *event_predicate = NULL;
+const char *filter_slot_names[MAX_FILTER_SLOTS] = {0};
+int filter_slots = 0;
+
+typedef struct FilterParser
+{
+    const char *expr;
+    const char *pos;
+} FilterParser;
+
+void filter_error(FilterParser *fp, const char *message)
+{
+    fprintf(stderr, "[ ERR ]: Filter expression %s at column %d: %s\n", message, (int)(fp->pos - fp->expr) + 1, fp->expr);
+    exit(EXIT_FAILURE);
+}
+
+bool filter_accept(FilterParser *fp, const char *token)
+{
+    while (isspace((unsigned char)*fp->pos))
+        fp->pos++;
+
+    size_t n = strlen(token);
+    if (strncmp(fp->pos, token, n) != 0)
+        return false;
+    fp->pos += n;
+    return true;
+}
+
+FilterNode *new_filter_node(enum FilterOp op, FilterNode *lhs, FilterNode *rhs)
+{
+    FilterNode *node = malloc(sizeof *node);
+    memset(node, 0, sizeof *node);
+    node->op = op;
+    node->lhs = lhs;
+    node->rhs = rhs;
+    return node;
+}
+
+int filter_slot(FilterParser *fp, const char *name, size_t n)
+{
+    for (int i = 0; i < filter_slots; i++)
+    {
+        if (strlen(filter_slot_names[i]) == n && strncmp(filter_slot_names[i], name, n) == 0)
+            return i;
+    }
+
+    if (filter_slots == MAX_FILTER_SLOTS)
+        filter_error(fp, "has too many parameters");
+
+    char *slot_name = malloc(n + 1);
+    memcpy(slot_name, name, n);
+    slot_name[n] = '\0';
+    filter_slot_names[filter_slots] = slot_name;
+    return filter_slots++;
+}
+
+FilterNode *parse_filter_or(FilterParser *fp);
+
+FilterNode *parse_filter_primary(FilterParser *fp)
+{
+    if (filter_accept(fp, "("))
+    {
+        FilterNode *node = parse_filter_or(fp);
+        if (!filter_accept(fp, ")"))
+            filter_error(fp, "expects ')'");
+        return node;
+    }
+
+    if (filter_accept(fp, "!"))
+        return new_filter_node(FILTER_NOT, parse_filter_primary(fp), NULL);
+
+    const char *start = fp->pos;
+    while (isalnum((unsigned char)*fp->pos) || *fp->pos == '_')
+        fp->pos++;
+    if (fp->pos == start || isdigit((unsigned char)*start))
+        filter_error(fp, "expects a parameter name");
+
+    FilterNode *node = new_filter_node(FILTER_PARAM, NULL, NULL);
+    node->slot = filter_slot(fp, start, fp->pos - start);
+
+    static const struct
+    {
+        const char *token;
+        enum FilterCmp cmp;
+    } cmps[] = {
+        {"==", CMP_EQ}, {"!=", CMP_NE}, {"<=", CMP_LE}, {">=", CMP_GE}, {"<", CMP_LT}, {">", CMP_GT}};
+
+    for (size_t i = 0; i < NOB_ARRAY_LEN(cmps); i++)
+    {
+        if (filter_accept(fp, cmps[i].token))
+        {
+            while (isspace((unsigned char)*fp->pos))
+                fp->pos++;
+
+            char *end = NULL;
+            errno = 0;
+            node->value = strtoull(fp->pos, &end, 0);
+            if (end == fp->pos || errno != 0)
+                filter_error(fp, "expects an integer value");
+            fp->pos = end;
+            node->op = FILTER_CMP;
+            node->cmp = cmps[i].cmp;
+            break;
+        }
+    }
+
+    return node;
+}
+
+FilterNode *parse_filter_and(FilterParser *fp)
+{
+    FilterNode *node = parse_filter_primary(fp);
+    while (filter_accept(fp, "&&"))
+        node = new_filter_node(FILTER_AND, node, parse_filter_primary(fp));
+    return node;
+}
+
+FilterNode *parse_filter_or(FilterParser *fp)
+{
+    FilterNode *node = parse_filter_and(fp);
+    while (filter_accept(fp, "||"))
+        node = new_filter_node(FILTER_OR, node, parse_filter_and(fp));
+    return node;
+}
+
+/* params of the event referenced by the predicate, resolved once when the predicate is compiled */
+ParamsList **resolve_event_predicate(EventConfig *event)
+{
+    if (event->filter_params == NULL)
+    {
+        event->filter_params = calloc(filter_slots, sizeof(ParamsList *));
+        for (int i = 0; i < filter_slots; i++)
+            event->filter_params[i] = find_pm_event_param_by_name(event, filter_slot_names[i]);
+    }
+    return event->filter_params;
+}
+
+/* parse a filter expression, shared by -w/--where and the --kpi definitions */
+FilterNode *compile_filter(const char *expr)
+{
+    FilterParser fp = {.expr = expr, .pos = expr};
+
+    FilterNode *node = parse_filter_or(&fp);
+    if (!filter_accept(&fp, "") || *fp.pos != '\0')
+        filter_error(&fp, "has unexpected input");
+
+    // slots may have been added, resolved before any decoder thread starts
+    EventConfig *event, *tmp;
+    HASH_ITER(hh, event_hash, event, tmp)
+    {
+        free(event->filter_params);
+        event->filter_params = NULL;
+        resolve_event_predicate(event);
+    }
+
+    return node;
+}
+
+FilterNode *compile_event_predicate(const char *expr)
+{
+    FilterNode *node = compile_filter(expr);
+
+    printf("[ CFG ]: Event filter expression compiled (%d parameters)\n", filter_slots);
+
+    return node;
+}
+
+bool eval_event_predicate(FilterNode *node, EventConfig *event, const uint8_t *params, uint16_t params_len)
+{
+    CTRParamValue value;
+
+    switch (node->op)
+    {
+    case FILTER_NOT:
+        return !eval_event_predicate(node->lhs, event, params, params_len);
+    case FILTER_AND:
+        return eval_event_predicate(node->lhs, event, params, params_len) && eval_event_predicate(node->rhs, event, params, params_len);
+    case FILTER_OR:
+        return eval_event_predicate(node->lhs, event, params, params_len) || eval_event_predicate(node->rhs, event, params, params_len);
+    case FILTER_PARAM:
+    case FILTER_CMP:
+    {
+        ParamsList *param = event->filter_params[node->slot];
+        if (param == NULL || param->kind != PARAM_UINT)
+            return false;
+        if (!find_pm_event_param_value(event, param, params, params_len, &value))
+            return false;
+        if (node->op == FILTER_PARAM)
+            return value.value != 0;
+
+        switch (node->cmp)
+        {
+        case CMP_EQ:
+            return value.value == node->value;
+        case CMP_NE:
+            return value.value != node->value;
+        case CMP_LT:
+            return value.value < node->value;
+        case CMP_LE:
+            return value.value <= node->value;
+        case CMP_GT:
+            return value.value > node->value;
+        case CMP_GE:
+            return value.value >= node->value;
+        }
+    }
+    }
+    return false;
+}
+
+/* true when the event record in buf (without type+length) passes the -w/--where filter;
+ * only the params the expression references are decoded */
+bool event_predicate_match(const uint8_t *buf, uint16_t len)
+{
+    EventConfig *event = find_pm_event(be32_to_cpu(buf));
+    if (event == NULL)
+        return false;
+
+    resolve_event_predicate(event);
+    return eval_event_predicate(event_predicate, event, buf + 3, len - 4 - 3);
+}
+
+/*
+ * --kpi counters, one definition per line of the file:
+ *
+ *   <KPI_NAME> = count <EVENT_NAME> grouped by <PARAM_NAME> [where <expr>]
+ *
+ * where <expr> is a -w/--where expression over the params of the event.
+ * Each decoder thread counts into its own open addressing map keyed by
+ * (kpi, rop, group value); the maps are merged when the threads finish.
+ * Events where the group param is not valid are not counted.
+ *
+ * With --kpi-bin <seconds> every (kpi, rop, group) slot also holds a dense
+ * array of counts, one per bin of the rop, indexed by the event timestamp.
+ * The rop length comes from the start and end in the file name (15 minutes
+ * for other names), so 1 and 5 minute rops get as many bins as they fill.
+ * Events stamped before the rop start count in the first bin, late ones in
+ * the last. Without it the rop is not part of the key and only the total is kept.
+ *
+ * Besides count, a definition can keep a sketch with a fixed size per slot:
+ *
+ *   <KPI> = distinct <PARAM> of <EVENT> grouped by <GROUP> [where <expr>]
+ *   <KPI> = top <N> <PARAM> of <EVENT> [where <expr>]
+ *
+ * distinct estimates the number of different values (e.g. UEs per cell)
+ * with a HyperLogLog, top finds the N most frequent values (e.g. cells by
+ * failures) with a space saving summary checked against a count-min sketch.
+ * Both merge across decoder threads, and their state goes to
+ * ctr_kpi_sketches.csv so rops can be merged later.
+ */
+#define DEFAULT_ROP_SECONDS (15 * 60) // files not following the standard name
+enum KpiKind
+{
+    KPI_COUNT,
+    KPI_DISTINCT,
+    KPI_TOP,
+};
+
+typedef struct Kpi
+{
+    int index;
+    char name[128];
+    enum KpiKind kind;
+    EventConfig *event;
+    ParamsList *group; // NULL for top
+    ParamsList *value; // the param distinct and top look at
+    int top_n;
+    FilterNode *where; // NULL counts every event
+} Kpi;
+
+typedef struct KpiDefs
+{
+    Kpi **items;
+    size_t count;
+    size_t capacity;
+} KpiDefs;
+
+KpiDefs kpis = {0};
+
+typedef struct KpiSlot
+{
+    uint32_t kpi; // index + 1, 0 - empty slot
+    int64_t rop;  // minutes since epoch of the rop start, 0 without --kpi-bin
+    uint64_t group;
+    uint64_t count;
+    CTRDateTime rop_time;
+    uint64_t *bins; // per bin of the rop with --kpi-bin, per bucket for --latency, NULL otherwise
+    int n_bins;
+    void *sketch;   // Hll or TopK of distinct and top kpis
+} KpiSlot;
+
+typedef struct KpiMap
+{
+    KpiSlot *slots;
+    size_t capacity; // power of 2
+    size_t count;
+} KpiMap;
+
+_Thread_local KpiMap *kpi_counters = NULL; // counts of the file being parsed, NULL without --kpi
+_Thread_local CTRDateTime kpi_rop_time;     // header date and rop of the file being parsed
+_Thread_local int kpi_rop_seconds;          // length of that rop, from the file name
+KpiMap kpi_totals = {0};
+pthread_mutex_t kpi_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t hash_u64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+int kpi_bins(int rop_seconds)
+{
+    return (rop_seconds + kpi_bin_seconds - 1) / kpi_bin_seconds;
+}
+
+/* rop length of a file from its name, DEFAULT_ROP_SECONDS when it is not a standard name */
+int ctr_file_rop_seconds(const char *name)
+{
+    CTRDateTime start;
+    int rop_seconds;
+    const char *node;
+    if (!parse_ctr_file_name(name, &start, &rop_seconds, &node))
+        return DEFAULT_ROP_SECONDS;
+    return rop_seconds;
+}
+
+/* room for n bins in a slot, the new ones count from 0 */
+void kpi_slot_bins(KpiSlot *slot, int n)
+{
+    if (slot->n_bins >= n)
+        return;
+    slot->bins = realloc(slot->bins, n * sizeof(uint64_t));
+    memset(slot->bins + slot->n_bins, 0, (n - slot->n_bins) * sizeof(uint64_t));
+    slot->n_bins = n;
+}
+
+/*
+ * HyperLogLog with 2^HLL_PRECISION registers, about 2.3% standard error.
+ * The register of a value is picked by the top bits of its hash and keeps
+ * the longest run of leading zeros seen in the remaining bits.
+ */
+#define HLL_PRECISION 11
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+typedef struct Hll
+{
+    uint8_t registers[HLL_REGISTERS];
+} Hll;
+
+void hll_add(Hll *hll, uint64_t value)
+{
+    uint64_t hash = hash_u64(value ^ 0x9e3779b97f4a7c15ULL);
+    uint32_t index = hash >> (64 - HLL_PRECISION);
+    uint64_t rest = hash << HLL_PRECISION;
+    uint8_t rank = rest == 0 ? 64 - HLL_PRECISION + 1 : __builtin_clzll(rest) + 1;
+    if (rank > hll->registers[index])
+        hll->registers[index] = rank;
+}
+
+void hll_merge(Hll *into, const Hll *from)
+{
+    for (int i = 0; i < HLL_REGISTERS; i++)
+    {
+        if (from->registers[i] > into->registers[i])
+            into->registers[i] = from->registers[i];
+    }
+}
+
+/* natural log for linear counting, keeps the build free of libm */
+double ln(double x)
+{
+    int exponent = 0;
+    for (; x > 2; x /= 2)
+        exponent++;
+    for (; x < 1; x *= 2)
+        exponent--;
+    double y = (x - 1) / (x + 1), term = y, sum = 0;
+    for (int i = 1; i < 40; i += 2, term *= y * y)
+        sum += term / i;
+    return 2 * sum + exponent * 0.6931471805599453;
+}
+
+uint64_t hll_estimate(const Hll *hll)
+{
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++)
+    {
+        sum += 1.0 / (1ULL << hll->registers[i]);
+        zeros += hll->registers[i] == 0;
+    }
+
+    double m = HLL_REGISTERS;
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0)
+        estimate = m * ln(m / zeros); // linear counting for small sets
+    return (uint64_t)(estimate + 0.5);
+}
+
+/*
+ * Space saving summary of TOPK_FACTOR * N counters: a value already in the
+ * summary counts up, a new one takes the place of the smallest counter and
+ * inherits its count as error. The count-min sketch next to it never
+ * undercounts either, the smaller of the two is reported.
+ */
+#define TOPK_FACTOR 8
+#define CM_DEPTH 4
+#define CM_WIDTH 2048
+
+typedef struct TopItem
+{
+    uint64_t value;
+    uint64_t count;
+    uint64_t error; // count may be this much too high
+} TopItem;
+
+typedef struct TopK
+{
+    int capacity;
+    int size;
+    TopItem *items;
+    uint32_t cm[CM_DEPTH][CM_WIDTH];
+} TopK;
+
+TopK *topk_new(int n)
+{
+    TopK *topk = calloc(1, sizeof *topk);
+    topk->capacity = n * TOPK_FACTOR;
+    topk->items = calloc(topk->capacity, sizeof(TopItem));
+    return topk;
+}
+
+void topk_free(TopK *topk)
+{
+    free(topk->items);
+    free(topk);
+}
+
+uint64_t topk_cm_estimate(const TopK *topk, uint64_t value)
+{
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < CM_DEPTH; row++)
+    {
+        uint32_t count = topk->cm[row][hash_u64(value + row * 0x9e3779b97f4a7c15ULL) % CM_WIDTH];
+        if (count < estimate)
+            estimate = count;
+    }
+    return estimate;
+}
+
+void topk_add(TopK *topk, uint64_t value)
+{
+    for (int row = 0; row < CM_DEPTH; row++)
+        topk->cm[row][hash_u64(value + row * 0x9e3779b97f4a7c15ULL) % CM_WIDTH]++;
+
+    int min = 0;
+    for (int i = 0; i < topk->size; i++)
+    {
+        if (topk->items[i].value == value)
+        {
+            topk->items[i].count++;
+            return;
+        }
+        if (topk->items[i].count < topk->items[min].count)
+            min = i;
+    }
+
+    if (topk->size < topk->capacity)
+    {
+        topk->items[topk->size++] = (TopItem){value, 1, 0};
+        return;
+    }
+    topk->items[min] = (TopItem){value, topk->items[min].count + 1, topk->items[min].count};
+}
+
+int compare_top_items(const void *a, const void *b)
+{
+    const TopItem *x = a, *y = b;
+    if (x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+    return (x->value > y->value) - (x->value < y->value);
+}
+
+uint64_t topk_min_count(const TopK *topk)
+{
+    if (topk->size < topk->capacity)
+        return 0; // nothing was dropped
+    uint64_t min = UINT64_MAX;
+    for (int i = 0; i < topk->size; i++)
+    {
+        if (topk->items[i].count < min)
+            min = topk->items[i].count;
+    }
+    return min;
+}
+
+/* merge two summaries: a value missing in one may have had up to its smallest count there */
+void topk_merge(TopK *into, const TopK *from)
+{
+    uint64_t into_min = topk_min_count(into);
+    uint64_t from_min = topk_min_count(from);
+    TopItem *merged = calloc(into->size + from->size, sizeof(TopItem));
+    int n = 0;
+
+    for (int i = 0; i < into->size; i++)
+    {
+        merged[n] = into->items[i];
+        merged[n].count += from_min;
+        merged[n].error += from_min;
+        for (int j = 0; j < from->size; j++)
+        {
+            if (from->items[j].value == merged[n].value)
+            {
+                merged[n].count += from->items[j].count - from_min;
+                merged[n].error += from->items[j].error - from_min;
+                break;
+            }
+        }
+        n++;
+    }
+    for (int j = 0; j < from->size; j++)
+    {
+        bool found = false;
+        for (int i = 0; i < into->size && !found; i++)
+            found = into->items[i].value == from->items[j].value;
+        if (!found)
+        {
+            merged[n] = from->items[j];
+            merged[n].count += into_min;
+            merged[n].error += into_min;
+            n++;
+        }
+    }
+
+    qsort(merged, n, sizeof(TopItem), compare_top_items);
+    into->size = n < into->capacity ? n : into->capacity;
+    memcpy(into->items, merged, into->size * sizeof(TopItem));
+    free(merged);
+
+    for (int row = 0; row < CM_DEPTH; row++)
+    {
+        for (int col = 0; col < CM_WIDTH; col++)
+            into->cm[row][col] += from->cm[row][col];
+    }
+}
+
+void free_sketch(enum KpiKind kind, void *sketch)
+{
+    if (kind == KPI_DISTINCT)
+        free(sketch);
+    else if (sketch)
+        topk_free(sketch);
+}
+
+KpiSlot *kpi_map_find(KpiMap *map, uint32_t kpi, int64_t rop, uint64_t group);
+
+void kpi_map_grow(KpiMap *map)
+{
+    KpiMap grown = {.capacity = map->capacity ? map->capacity * 2 : 256};
+    grown.slots = calloc(grown.capacity, sizeof(KpiSlot));
+
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        KpiSlot *slot = &map->slots[i];
+        if (slot->kpi != 0)
+            *kpi_map_find(&grown, slot->kpi, slot->rop, slot->group) = *slot;
+    }
+    free(map->slots);
+    *map = grown;
+}
+
+/* slot of (kpi, rop, group), inserted with a zero count when missing; linear probing */
+KpiSlot *kpi_map_find(KpiMap *map, uint32_t kpi, int64_t rop, uint64_t group)
+{
+    if ((map->count + 1) * 4 > map->capacity * 3)
+        kpi_map_grow(map);
+
+    size_t mask = map->capacity - 1;
+    size_t i = hash_u64((group * 31 + rop) * 31 + kpi) & mask;
+    while (map->slots[i].kpi != 0)
+    {
+        KpiSlot *slot = &map->slots[i];
+        if (slot->kpi == kpi && slot->rop == rop && slot->group == group)
+            return slot;
+        i = (i + 1) & mask;
+    }
+
+    map->slots[i].kpi = kpi;
+    map->slots[i].rop = rop;
+    map->slots[i].group = group;
+    map->count++;
+    return &map->slots[i];
+}
+
+/* empty the map for the next file; drop frees what was counted, else it was merged away */
+void kpi_map_reset(KpiMap *map, bool drop)
+{
+    for (size_t i = 0; drop && i < map->capacity; i++)
+    {
+        KpiSlot *slot = &map->slots[i];
+        if (slot->kpi == 0)
+            continue;
+        free(slot->bins);
+        if (slot->sketch)
+            free_sketch(kpis.items[slot->kpi - 1]->kind, slot->sketch);
+    }
+    if (map->slots)
+        memset(map->slots, 0, map->capacity * sizeof(KpiSlot));
+    map->count = 0;
+}
+
+void kpi_map_merge(KpiMap *into, KpiMap *from)
+{
+    for (size_t i = 0; i < from->capacity; i++)
+    {
+        KpiSlot *slot = &from->slots[i];
+        if (slot->kpi == 0)
+            continue;
+
+        KpiSlot *total = kpi_map_find(into, slot->kpi, slot->rop, slot->group);
+        total->count += slot->count;
+        total->rop_time = slot->rop_time;
+        if (slot->sketch != NULL && total->sketch == NULL)
+        {
+            total->sketch = slot->sketch; // taken over
+        }
+        else if (slot->sketch != NULL)
+        {
+            Kpi *kpi = kpis.items[slot->kpi - 1];
+            if (kpi->kind == KPI_DISTINCT)
+                hll_merge(total->sketch, slot->sketch);
+            else
+                topk_merge(total->sketch, slot->sketch);
+            free_sketch(kpi->kind, slot->sketch);
+        }
+        if (slot->bins == NULL)
+            continue;
+        kpi_slot_bins(total, slot->n_bins);
+        for (int bin = 0; bin < slot->n_bins; bin++)
+            total->bins[bin] += slot->bins[bin];
+        free(slot->bins);
+    }
+}
+
+/* bin of the rop the event falls in, -1 when the event has no timestamp */
+int kpi_event_bin(EventConfig *event, const uint8_t *params, uint16_t params_len)
+{
+    CTRTime t;
+    if (!decode_pm_event_timestamp(event, params, params_len, &t))
+        return -1;
+
+    int offset = (t.hour * 60 + t.minute) * 60 + t.second - (kpi_rop_time.hour * 60 + kpi_rop_time.minute) * 60;
+    if (offset < -12 * 60 * 60)
+        offset += 24 * 60 * 60; // rop crossing midnight
+    if (offset < 0)
+        return 0; // early events count in the first bin
+    int bin = offset / kpi_bin_seconds;
+    int bins = kpi_bins(kpi_rop_seconds);
+    return bin < bins ? bin : bins - 1; // late events count in the last bin
+}
+
+void count_kpis(const uint8_t *buf, uint16_t len)
+{
+    if (len < 4 + 3)
+        return; // no event id
+    EventConfig *event = find_pm_event(be32_to_cpu(buf));
+    if (event == NULL || event->n_kpis == 0)
+        return;
+
+    const uint8_t *params = buf + 3;
+    uint16_t params_len = len - 4 - 3;
+    int64_t rop = kpi_bin_seconds > 0 ? ctr_date_time_minutes(&kpi_rop_time) : 0;
+    int bin = -2; // not decoded yet
+    for (int i = 0; i < event->n_kpis; i++)
+    {
+        Kpi *kpi = event->kpis[i];
+        if (kpi->where && !eval_event_predicate(kpi->where, event, params, params_len))
+            continue;
+
+        CTRParamValue group = {.valid = true}, value;
+        if (kpi->group && (!find_pm_event_param_value(event, kpi->group, params, params_len, &group) || !group.valid))
+            continue;
+        if (kpi->value && (!find_pm_event_param_value(event, kpi->value, params, params_len, &value) || !value.valid))
+            continue;
+
+        KpiSlot *slot = kpi_map_find(kpi_counters, kpi->index + 1, rop, group.value);
+        slot->count++;
+        slot->rop_time = kpi_rop_time;
+        if (kpi->kind == KPI_DISTINCT)
+        {
+            if (slot->sketch == NULL)
+                slot->sketch = calloc(1, sizeof(Hll));
+            hll_add(slot->sketch, value.value);
+            continue;
+        }
+        if (kpi->kind == KPI_TOP)
+        {
+            if (slot->sketch == NULL)
+                slot->sketch = topk_new(kpi->top_n);
+            topk_add(slot->sketch, value.value);
+            continue;
+        }
+        if (kpi_bin_seconds == 0)
+            continue;
+
+        if (bin == -2)
+            bin = kpi_event_bin(event, params, params_len);
+        kpi_slot_bins(slot, kpi_bins(kpi_rop_seconds));
+        if (bin >= 0)
+            slot->bins[bin]++;
+    }
+}
+
+void kpi_definition_error(const char *path, int line_no, const char *message, const char *name)
+{
+    fprintf(stderr, "[ ERR ]: %s:%d: %s %s\n", path, line_no, message, name);
+    exit(EXIT_FAILURE);
+}
+
+int load_kpi_definitions(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_no = 0;
+    while (getline(&line, &line_size, f) > 0)
+    {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *text = line + strspn(line, " \t");
+        if (*text == '\0' || *text == '#')
+            continue;
+
+        Kpi *kpi = calloc(1, sizeof *kpi);
+        char event_name[128], group_name[128] = {0}, value_name[128] = {0};
+        int n = 0;
+        if (sscanf(text, "%127s = count %127s grouped by %127s%n", kpi->name, event_name, group_name, &n) == 3 && n > 0)
+            kpi->kind = KPI_COUNT;
+        else if (n = 0, sscanf(text, "%127s = distinct %127s of %127s grouped by %127s%n", kpi->name, value_name, event_name, group_name, &n) == 4 && n > 0)
+            kpi->kind = KPI_DISTINCT;
+        else if (n = 0, sscanf(text, "%127s = top %d %127s of %127s%n", kpi->name, &kpi->top_n, value_name, event_name, &n) == 4 && n > 0 && kpi->top_n > 0)
+            kpi->kind = KPI_TOP;
+        else
+            kpi_definition_error(path, line_no, "expected '<KPI> = count <EVENT> grouped by <PARAM>', 'distinct <PARAM> of <EVENT> grouped by <PARAM>'"
+                                                " or 'top <N> <PARAM> of <EVENT>' [where <expr>], got", text);
+
+        kpi->index = kpis.count;
+        kpi->event = find_pm_event_by_name(event_name);
+        if (kpi->event == NULL)
+            kpi_definition_error(path, line_no, "event not in the config:", event_name);
+        if (*group_name && (kpi->group = find_pm_event_param_by_name(kpi->event, group_name)) == NULL)
+            kpi_definition_error(path, line_no, "param not in the event:", group_name);
+        if (*value_name && (kpi->value = find_pm_event_param_by_name(kpi->event, value_name)) == NULL)
+            kpi_definition_error(path, line_no, "param not in the event:", value_name);
+
+        char *rest = text + n + strspn(text + n, " \t");
+        if (strncmp(rest, "where", 5) == 0 && isspace((unsigned char)rest[5]))
+            kpi->where = compile_filter(rest + 5);
+        else if (*rest != '\0')
+            kpi_definition_error(path, line_no, "expected 'where <expr>', got", rest);
+
+        EventConfig *event = kpi->event;
+        event->kpis = realloc(event->kpis, (event->n_kpis + 1) * sizeof(Kpi *));
+        event->kpis[event->n_kpis++] = kpi;
+        nob_da_append(&kpis, kpi);
+    }
+    free(line);
+    fclose(f);
+
+    printf("[ CFG ]: %zu KPI counters loaded from %s\n", kpis.count, path);
+    return EXIT_SUCCESS;
+}
+
+int compare_kpi_slots(const void *a, const void *b)
+{
+    const KpiSlot *x = a, *y = b;
+    if (x->kpi != y->kpi)
+        return x->kpi < y->kpi ? -1 : 1;
+    if (x->group != y->group)
+        return x->group < y->group ? -1 : 1;
+    return (x->rop > y->rop) - (x->rop < y->rop);
+}
+
+const char *sketch_kind_name(enum KpiKind kind)
+{
+    return kind == KPI_DISTINCT ? "hll" : "topk";
+}
+
+void print_sketch_state(FILE *f, enum KpiKind kind, void *sketch)
+{
+    if (kind == KPI_DISTINCT)
+    {
+        // registers hold at most 64 - HLL_PRECISION + 1, 2 hex digits each
+        Hll *hll = sketch;
+        for (int r = 0; r < HLL_REGISTERS; r++)
+            fprintf(f, "%02x", hll->registers[r]);
+    }
+    else
+    {
+        // capacity, then value:count:error of the summary, the count-min part is not kept
+        TopK *topk = sketch;
+        fprintf(f, "%d", topk->capacity);
+        for (int v = 0; v < topk->size; v++)
+            fprintf(f, " %llu:%llu:%llu", (unsigned long long)topk->items[v].value,
+                    (unsigned long long)topk->items[v].count, (unsigned long long)topk->items[v].error);
+    }
+}
+
+/* inverse of print_sketch_state, NULL when the state does not parse */
+void *parse_sketch_state(enum KpiKind kind, const char *state)
+{
+    if (kind == KPI_DISTINCT)
+    {
+        if (strlen(state) < 2 * HLL_REGISTERS)
+            return NULL;
+        Hll *hll = calloc(1, sizeof *hll);
+        for (int r = 0; r < HLL_REGISTERS; r++)
+            sscanf(state + 2 * r, "%2hhx", &hll->registers[r]);
+        return hll;
+    }
+
+    int capacity, n;
+    if (sscanf(state, "%d%n", &capacity, &n) != 1 || capacity < TOPK_FACTOR)
+        return NULL;
+    TopK *topk = topk_new(capacity / TOPK_FACTOR);
+    unsigned long long value, count, error;
+    for (state += n; topk->size < topk->capacity && sscanf(state, " %llu:%llu:%llu%n", &value, &count, &error, &n) == 3; state += n)
+        topk->items[topk->size++] = (TopItem){value, count, error};
+    return topk;
+}
+
+void *clone_sketch(enum KpiKind kind, void *sketch)
+{
+    if (kind == KPI_DISTINCT)
+    {
+        Hll *hll = malloc(sizeof *hll);
+        memcpy(hll, sketch, sizeof *hll);
+        return hll;
+    }
+    TopK *from = sketch;
+    TopK *topk = topk_new(from->capacity / TOPK_FACTOR);
+    topk->size = from->size;
+    memcpy(topk->items, from->items, from->size * sizeof(TopItem));
+    memcpy(topk->cm, from->cm, sizeof topk->cm);
+    return topk;
+}
+
+/* state of the distinct and top sketches, to merge them over several rops later */
+int print_kpi_sketches_csv(KpiSlot *slots, size_t rows)
+{
+    bool result = true;
+    char path[500] = {0};
+    sprintf(path, sketches_filename_format, output_dir);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        nob_return_defer(false);
+    }
+
+    fprintf(f, "kpi,kind,date,rop,group,events,state\n");
+    for (size_t i = 0; i < rows; i++)
+    {
+        KpiSlot *slot = &slots[i];
+        Kpi *kpi = kpis.items[slot->kpi - 1];
+        if (slot->sketch == NULL)
+            continue;
+
+        char date[9] = "", rop[5] = "";
+        if (kpi_bin_seconds > 0)
+        {
+            format_date(date, &slot->rop_time);
+            format_rop(rop, &slot->rop_time);
+        }
+        fprintf(f, "%s,%s,%s,%s,%llu,%llu,", kpi->name, sketch_kind_name(kpi->kind), date, rop,
+                (unsigned long long)slot->group, (unsigned long long)slot->count);
+        print_sketch_state(f, kpi->kind, slot->sketch);
+        fprintf(f, "\n");
+    }
+
+defer:
+    if (f)
+        fclose(f);
+    return result;
+}
+
+/* pack the used slots to the front, sorted; the map can not be looked up afterwards */
+size_t kpi_map_sort(KpiMap *map)
+{
+    size_t rows = 0;
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        if (map->slots[i].kpi != 0)
+            map->slots[rows++] = map->slots[i];
+    }
+    qsort(map->slots, rows, sizeof(KpiSlot), compare_kpi_slots);
+    return rows;
+}
+
+int print_kpi_csv()
+{
+    bool result = true;
+    char path[500] = {0};
+    sprintf(path, kpi_filename_format, output_dir);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        nob_return_defer(false);
+    }
+
+    size_t rows = kpi_map_sort(&kpi_totals);
+
+    if (kpi_bin_seconds > 0)
+        fprintf(f, "kpi,event_name,group_param,group,date,rop,bin_start,count\n");
+    else
+        fprintf(f, "kpi,event_name,group_param,group,count\n");
+    for (size_t i = 0; i < rows; i++)
+    {
+        KpiSlot *slot = &kpi_totals.slots[i];
+        Kpi *kpi = kpis.items[slot->kpi - 1];
+        char date[9], rop[5];
+        format_date(date, &slot->rop_time);
+        format_rop(rop, &slot->rop_time);
+
+        if (kpi->kind != KPI_COUNT || kpi_bin_seconds == 0)
+        {
+            // top has a row per value in the summary, distinct its estimate in count
+            TopK *topk = kpi->kind == KPI_TOP ? slot->sketch : NULL;
+            if (topk)
+                qsort(topk->items, topk->size, sizeof(TopItem), compare_top_items);
+            int values = topk ? (topk->size < kpi->top_n ? topk->size : kpi->top_n) : 1;
+            for (int v = 0; v < values; v++)
+            {
+                uint64_t group = topk ? topk->items[v].value : slot->group;
+                uint64_t count = kpi->kind == KPI_DISTINCT ? hll_estimate(slot->sketch) : slot->count;
+                if (topk)
+                {
+                    count = topk_cm_estimate(topk, group);
+                    if (topk->items[v].count < count)
+                        count = topk->items[v].count;
+                }
+                fprintf(f, "%s,%s,%s,%llu,", kpi->name, kpi->event->name, kpi->group ? kpi->group->name : kpi->value->name,
+                        (unsigned long long)group);
+                if (kpi_bin_seconds > 0)
+                    fprintf(f, "%s,%s,,", date, rop);
+                fprintf(f, "%llu\n", (unsigned long long)count);
+            }
+            continue;
+        }
+
+        // every bin, empty ones are what shows an outage
+        for (int bin = 0; bin < slot->n_bins; bin++)
+        {
+            int start = (slot->rop_time.hour * 60 + slot->rop_time.minute) * 60 + bin * kpi_bin_seconds;
+            fprintf(f, "%s,%s,%s,%llu,%s,%s,%02d%02d%02d,%llu\n", kpi->name, kpi->event->name, kpi->group->name,
+                    (unsigned long long)slot->group, date, rop, start / 3600 % 24, start / 60 % 60, start % 60,
+                    (unsigned long long)slot->bins[bin]);
+        }
+    }
+    printf("[ INF ]: %zu KPI groups written to %s\n", rows, path);
+
+    for (size_t i = 0; i < kpis.count; i++)
+    {
+        if (kpis.items[i]->kind != KPI_COUNT)
+        {
+            print_kpi_sketches_csv(kpi_totals.slots, rows);
+            break;
+        }
+    }
+
+defer:
+    if (f)
+        fclose(f);
+    return result;
+}
+
+int get_file_lenght(FILE *fp)
+{
+    int lenght = 0;
+    fseek(fp, 0L, SEEK_END);
+    lenght = ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+
+    return lenght;
+}
+
+int get_file_pos(FILE *fp)
+{
+    return ftell(fp);
+}
+
+int read_header(CTRStruct *ptr, uint16_t len, uint8_t *buf)
+{
+    ptr->type = HEADER;
+    ptr->header.length = len;
+    ptr->header.parse_time = time(0);
+
+    uint16_t buf_pos = 0; // buf holds the record without the 4 bytes of type+length
+
+    scan_string_from_buf(ptr->header.file_version, buf, &buf_pos, 5);
+    scan_string_from_buf(ptr->header.pm_version, buf, &buf_pos, 13);
+    scan_string_from_buf(ptr->header.pm_revision, buf, &buf_pos, 5);
+    scan_date_time(&ptr->header.date_time, buf, &buf_pos); // date and rop are formatted from it
+    scan_string_from_buf(ptr->header.ne_user_label, buf, &buf_pos, 128);
+    scan_string_from_buf(ptr->header.ne_logical_label, buf, &buf_pos, 255);
+
+    return EXIT_SUCCESS;
+}
+
+int read_scanner(CTRStruct *ptr, uint16_t len, uint8_t *buf)
+{
+    ptr->type = SCANNER;
+    ptr->scanner.length = len;
+
+    uint16_t buf_pos = 0; // buf holds the record without the 4 bytes of type+length
+
+    scan_timestamp(&ptr->scanner.timestamp, buf, &buf_pos);
+    scan_bytes_from_buf(ptr->scanner.scannerid, buf, &buf_pos, 3);
+    scan_bytes_from_buf(ptr->scanner.status, buf, &buf_pos, 1);
+    scan_bytes_from_buf(ptr->scanner.padding, buf, &buf_pos, 2);
+
+    return EXIT_SUCCESS;
+}
+
+int read_event(CTRStruct *ptr, uint16_t len, uint8_t *buf)
+{
+    ptr->type = EVENT;
+    ptr->event.length = len;
+
+    uint16_t buf_pos = 0; // buf holds the record without the 4 bytes of type+length
+
+    ptr->event.id = be32_to_cpu(buf);
+    buf_pos = buf_pos + 3;
+
+    EventConfig *event = find_pm_event(ptr->event.id);
+    strcpy(ptr->event.name, event ? event->name : "");
+
+    int event_parameter_size = len - buf_pos - 4;
+    uint8_t *event_parameters = malloc(event_parameter_size);
+    scan_bytes_from_buf(event_parameters, buf, &buf_pos, len - buf_pos - 4);
+    ptr->event.parameters = event_parameters;
+
+    if (event != NULL)
+        ptr->event.has_timestamp = decode_pm_event_timestamp(event, event_parameters, event_parameter_size, &ptr->event.timestamp);
+
+    if (event != NULL && event->n_columns > 0)
+    {
+        ptr->event.values = calloc(event->n_columns, sizeof(CTRParamValue));
+        decode_pm_event_columns(event, event_parameters, event_parameter_size, ptr->event.values);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int read_footer(CTRStruct *ptr, uint16_t len, uint8_t *buf)
+{
+    ptr->type = FOOTER;
+    ptr->event.length = len;
+
+    uint16_t buf_pos = 0; // buf holds the record without the 4 bytes of type+length
+
+    scan_date_time(&ptr->footer.date_time, buf, &buf_pos);
+    scan_bytes_from_buf(ptr->footer.padding, buf, &buf_pos, 1);
+
+    return EXIT_SUCCESS;
+}
+
+enum FramingError
+{
+    FRAMING_OK,
+    FRAMING_SHORT_READ,
+    FRAMING_BAD_LENGTH,
+    FRAMING_BAD_TYPE,
+};
+
+const char *framing_error_str(enum FramingError error)
+{
+    switch (error)
+    {
+    case FRAMING_OK:
+        return "ok";
+    case FRAMING_SHORT_READ:
+        return "short read";
+    case FRAMING_BAD_LENGTH:
+        return "record length not valid";
+    case FRAMING_BAD_TYPE:
+        return "record type not known";
+    }
+    return "";
+}
+
+/* smallest record of each type the read_* functions can decode */
+uint16_t record_min_length(uint16_t type)
+{
+    switch (type)
+    {
+    case HEADER:
+        return 4 + 5 + 13 + 5 + 7 + 128 + 255;
+    case SCANNER:
+        return 4 + 5 + 3 + 1 + 2;
+    case EVENT:
+        return 4 + 3;
+    case FOOTER:
+        return 4 + 7;
+    }
+    return UINT16_MAX;
+}
+
+/* a HEADER is only valid as the first record of a file */
+bool record_plausible(uint16_t len, uint16_t type, long remaining, bool first)
+{
+    if (RecordTypeValid(type) != 1 || (type == HEADER) != first)
+        return false;
+    return len >= record_min_length(type) && len <= remaining;
+}
+
+enum FramingError read_record_len_type(uint16_t *len, uint16_t *type, FILE *fp, long remaining, bool first)
+{
+    uint8_t buf[4];
+
+    if (fread(buf, 1, sizeof buf, fp) != sizeof buf)
+        return FRAMING_SHORT_READ;
+
+    *len = be16_to_cpu(buf);
+    *type = be16_to_cpu(buf + 2);
+    if (RecordTypeValid(*type) != 1 || (*type == HEADER) != first)
+        return FRAMING_BAD_TYPE;
+    if (!record_plausible(*len, *type, remaining, first))
+        return FRAMING_BAD_LENGTH;
+
+    return FRAMING_OK;
+}
+
+#define RESYNC_WINDOW (1024 * 1024)
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+#define SWAR_HAS_ZERO(v) (((v) - SWAR_ONES) & ~(v) & SWAR_HIGHS)
+
+/* Index of the first plausible record boundary in buf[0..limit), checking that the
+ * record after it is plausible as well (or ends exactly at the end of the file).
+ * The low byte of the type must be 3, 4 or 5: 8 bytes at a time are tested for one
+ * of those and words without any are skipped before the candidates are checked. */
+long scan_record_boundary(const uint8_t *buf, long limit, long size, bool at_eof)
+{
+    long i = 0;
+    while (i < limit)
+    {
+        if (i + 3 + 8 <= size)
+        {
+            uint64_t word;
+            memcpy(&word, buf + i + 3, sizeof word);
+            if (!(SWAR_HAS_ZERO(word ^ (SWAR_ONES * SCANNER)) | SWAR_HAS_ZERO(word ^ (SWAR_ONES * EVENT)) | SWAR_HAS_ZERO(word ^ (SWAR_ONES * FOOTER))))
+            {
+                i += 8;
+                continue;
+            }
+        }
+
+        long end = (i + 8 < limit) ? i + 8 : limit;
+        for (; i < end; i++)
+        {
+            if (i + 4 > size)
+                return -1;
+
+            uint16_t len = be16_to_cpu(buf + i);
+            uint16_t type = be16_to_cpu(buf + i + 2);
+            if (!record_plausible(len, type, size - i + (at_eof ? 0 : UINT16_MAX), false))
+                continue;
+
+            long next = i + len;
+            if (at_eof && next == size)
+                return i;
+            if (next + 4 > size)
+                continue;
+            if (record_plausible(be16_to_cpu(buf + next), be16_to_cpu(buf + next + 2), size - next + (at_eof ? 0 : UINT16_MAX), false))
+                return i;
+        }
+    }
+    return -1;
+}
+
+/* offset of the next plausible record at or after from, -1 when there is none */
+long find_record_boundary(FILE *fp, long from, long file_size)
+{
+    static _Thread_local uint8_t window[RESYNC_WINDOW + UINT16_MAX + 4];
+    long base = from;
+
+    while (base < file_size)
+    {
+        long n = file_size - base;
+        if (n > (long)sizeof window)
+            n = sizeof window;
+
+        fseek(fp, base, SEEK_SET);
+        if (fread(window, 1, n, fp) != (size_t)n)
+            return -1;
+
+        bool at_eof = base + n == file_size;
+        long limit = at_eof ? n : RESYNC_WINDOW; // candidates past limit are checked in the next window
+        long found = scan_record_boundary(window, limit, n, at_eof);
+        if (found >= 0)
+            return base + found;
+        if (at_eof)
+            break;
+        base += limit;
+    }
+    return -1;
+}
+
+pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER; // decoder threads quarantine concurrently
+
+void quarantine_file(const char *path, long offset, const char *reason)
+{
+    char quarantine_filename[500] = {0};
+    sprintf(quarantine_filename, quarantine_filename_format, output_dir);
+
+    pthread_mutex_lock(&quarantine_lock);
+    FILE *f = fopen(quarantine_filename, files_quarantined == 0 ? "w" : "a");
+    if (f == NULL)
+    {
+        pthread_mutex_unlock(&quarantine_lock);
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", quarantine_filename, strerror(errno));
+        return;
+    }
+    if (files_quarantined == 0)
+        fprintf(f, "offset,reason,filename\n");
+    fprintf(f, "%ld,%s,%s\n", offset, reason, path);
+    fclose(f);
+
+    files_quarantined++;
+    pthread_mutex_unlock(&quarantine_lock);
+    printf("[ WRN ]: Quarantined %s at offset %ld: %s\n", path, offset, reason);
+}
+
+/* Peek the 3 byte event id that follows the record length/type prefix. When the
+ * event is not in the allow-list the rest of the record is skipped without being
+ * read or decoded and 1 is returned; otherwise the file is rewound to the id. */
+int skip_filtered_event(uint16_t len, FILE *fp)
+{
+    uint8_t buf[3];
+
+    if (len < 4 + sizeof buf || fread(buf, 1, sizeof buf, fp) != sizeof buf)
+        return 0; // left to the payload read to report
+
+    if (pm_event_selected(be32_to_cpu(buf)))
+    {
+        fseek(fp, -(long)sizeof buf, SEEK_CUR);
+        return 0;
+    }
+
+    fseek(fp, len - 4 - sizeof buf, SEEK_CUR);
+    return 1;
+}
+
+/* read the record payload following the 4 bytes of type+length into buf */
+int read_record_payload(uint8_t *buf, uint16_t len, FILE *fp)
+{
+    if (len < 4)
+        return -1;
+
+    if (fread(buf, 1, len - 4, fp) != (size_t)(len - 4))
+        return -1;
+
+    return EXIT_SUCCESS;
+}
+
+/* free the records of a parsed file once they are written */
+int free_events(CTRStruct *event)
+{
+    CTRStruct *next = NULL;
+    while (event != NULL)
+    {
+        next = event->next;
+        if (event->type == EVENT)
+        {
+            free(event->event.parameters);
+            free(event->event.values);
+        }
+        free(event);
+        event = next;
+    }
+    return EXIT_SUCCESS;
+}
+
+CTRStruct *add_record(int id, uint16_t type, uint16_t lenght, uint8_t *buf, int file_id)
+{
+    CTRStruct *new_node = malloc(sizeof(CTRStruct));
+    memset(new_node, 0, sizeof(CTRStruct));
+
+    new_node->file_id = file_id;
+    new_node->record_id = id;
+
+    switch (type)
+    {
+    case HEADER:
+        read_header(new_node, lenght, buf);
+        return new_node;
+    case SCANNER:
+        read_scanner(new_node, lenght, buf);
+        return new_node;
+    case EVENT:
+        read_event(new_node, lenght, buf);
+        return new_node;
+    case FOOTER:
+        read_footer(new_node, lenght, buf);
+        return new_node;
+    default:
+        printf("Record type not known");
+        return NULL;
+    }
+}
+
+void print_header(CTRStruct *ptr)
 {
     printf("\nHeader (%d bytes):\n", ptr->header.length);
     printf("{\n");
-    printf("timestamp: %s\n", ptr->header.date_time);
+    char date_time[20];
+    printf("timestamp: %s\n", format_date_time(date_time, &ptr->header.date_time));
     printf("file-id: %d\n", ptr->file_id);
     printf("file-name: %s\n", ptr->header.file_name);
     printf("file-format-version: %s\n", ptr->header.file_version);
@@ -620,141 +3589,2055 @@ void print_header(CTRStruct *ptr)
     printf("}\n");
 }
 
-void print_scanner(CTRStruct *ptr)
-{
-    printf("\nScanner (%d bytes):\n", ptr->scanner.length);
-    printf("{\n");
-    printf("timestamp: %s\n", ptr->scanner.timestamp);
-    printf("file-id: %d\n", ptr->file_id);
-    printf("Scannerid: 0x%02x%02x%02x\n", ptr->scanner.scannerid[0], ptr->scanner.scannerid[1], ptr->scanner.scannerid[2]);
-    printf("Status: 0x%x\n", ptr->scanner.status[0]);
-    printf("Padding Bytes: 0x%02x%02x%02x\n", ptr->scanner.padding[0], ptr->scanner.padding[1], ptr->scanner.padding[2]);
-    printf("}\n");
+void print_scanner(CTRStruct *ptr)
+{
+    printf("\nScanner (%d bytes):\n", ptr->scanner.length);
+    printf("{\n");
+    char timestamp[13];
+    printf("timestamp: %s\n", format_time(timestamp, &ptr->scanner.timestamp));
+    printf("file-id: %d\n", ptr->file_id);
+    printf("Scannerid: 0x%02x%02x%02x\n", ptr->scanner.scannerid[0], ptr->scanner.scannerid[1], ptr->scanner.scannerid[2]);
+    printf("Status: 0x%x\n", ptr->scanner.status[0]);
+    printf("Padding Bytes: 0x%02x%02x%02x\n", ptr->scanner.padding[0], ptr->scanner.padding[1], ptr->scanner.padding[2]);
+    printf("}\n");
+}
+
+void print_event(CTRStruct *ptr)
+{
+    printf("\nEvent (%d bytes):\n", ptr->event.length);
+    printf("{\n");
+    printf("file-id: %d\n", ptr->file_id);
+    if (ptr->event.name)
+    {
+        printf("Event: %s (%d)\n", ptr->event.name, ptr->event.id);
+    }
+    else
+    {
+        printf("Event: %d\n", ptr->event.id);
+    }
+    if (ptr->event.has_timestamp)
+    {
+        char timestamp[13];
+        printf("timestamp: %s\n", format_time(timestamp, &ptr->event.timestamp));
+    }
+    printf("Event parameters: ");
+
+    for (int i = 0; i <= ptr->event.length - 4 - 3; i = i + 2)
+    {
+        printf("%02x%02x ", ptr->event.parameters[i], ptr->event.parameters[i + 1]);
+    }
+    printf("}\n");
+}
+
+void print_footer(CTRStruct *ptr)
+{
+    printf("\nFooter (%d bytes):\n", ptr->footer.length);
+    printf("{\n");
+    char date_time[20];
+    printf("timestamp: %s\n", format_date_time(date_time, &ptr->footer.date_time));
+    printf("file-id: %d\n", ptr->file_id);
+    printf("Padding Bytes: 0x%02x\n", ptr->scanner.padding[0]);
+    printf("}\n");
+}
+
+int dump_records(CTRStruct *node)
+{
+    if (node == NULL)
+        return EXIT_SUCCESS;
+    do
+    {
+        switch (node->type)
+        {
+        case HEADER:
+            print_header(node);
+            break;
+        case SCANNER:
+            print_scanner(node);
+            break;
+        case EVENT:
+            print_event(node);
+            break;
+        case FOOTER:
+            print_footer(node);
+            break;
+        }
+    } while ((node = node->next) != NULL);
+
+    return EXIT_SUCCESS;
+}
+
+int list_records(CTRStruct *node)
+{
+    if (node == NULL)
+        return EXIT_SUCCESS;
+    printf("\nRecords:\n");
+    printf("------------------------------------------------------------------------\n");
+    printf("%3s %3s %6s %5s           %9s\n", "File_Id", "Id", "Bytes", "Type", "Event(Id)");
+
+    do
+    {
+        switch (node->type)
+        {
+        case HEADER:
+            printf("%6d  %3d  %5d  %-7s\n", node->file_id, node->record_id, node->header.length, "HEADER");
+            break;
+        case SCANNER:
+            printf("%6d  %3d  %5d  %-7s\n", node->file_id, node->record_id, node->header.length, "SCANNER");
+            break;
+        case EVENT:
+            printf("%6d  %3d  %5d  %-7s   %s (%d)\n", node->file_id, node->record_id, node->header.length, "EVENT", node->event.name, node->event.id);
+            break;
+        case FOOTER:
+            printf("%6d  %3d  %5d  %-7s\n", node->file_id, node->record_id, node->header.length, "FOOTER");
+            break;
+        }
+    } while ((node = node->next) != NULL);
+
+    return EXIT_SUCCESS;
+}
+
+void print_record_csv(FILE *f, CTRStruct *node)
+{
+    switch (node->type)
+    {
+    case HEADER:
+        fprintf(f, "%d,%s,%d\n", node->file_id, "HEADER", node->header.length);
+        break;
+    case SCANNER:
+        fprintf(f, "%d,%s,%d\n", node->file_id, "SCANNER", node->scanner.length);
+        break;
+    case EVENT:
+        fprintf(f, "%d,%s,%d,%d,%s\n", node->file_id, "EVENT", node->event.length, node->event.id, node->event.name);
+        break;
+    case FOOTER:
+        fprintf(f, "%d,%s,%d\n", node->file_id, "FOOTER", node->footer.length);
+        break;
+    }
+}
+
+int print_records_csv(CTRStruct *node, const char *path, char *mode)
+{
+    bool result = true;
+
+    FILE *f = fopen(path, mode);
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        nob_return_defer(false);
+    }
+
+    if (node == NULL)
+        nob_return_defer(false);
+
+    if (strcmp(mode, "w") == 0)
+        fprintf(f, "File_Id,Event_Name,Event_Size_bytes,Event_Id,Event_name\n");
+
+    do
+    {
+        print_record_csv(f, node);
+    } while ((node = node->next) != NULL);
+
+defer:
+    if (f)
+        fclose(f);
+    return result;
+}
+
+void print_param_value_csv(FILE *f, ParamsList *param, const uint8_t *params, CTRParamValue *value)
+{
+    if (!value->valid)
+        return;
+
+    if (param->kind == PARAM_UINT)
+    {
+        fprintf(f, "%llu", (unsigned long long)value->value);
+        return;
+    }
+
+    BitReader br = {.buf = params, .size = (value->bit_pos + value->length * 8), .pos = value->bit_pos};
+    for (int i = 0; i < value->length; i++)
+        fprintf(f, "%02x", (unsigned int)read_bits(&br, 8));
+}
+
+/* copy the bytes of a byte param (not necessarily byte aligned) to the blob file */
+void write_param_blob(FILE *blobs, const uint8_t *params, CTRParamValue *value)
+{
+    if ((value->bit_pos & 7) == 0)
+    {
+        fwrite(params + value->bit_pos / 8, 1, value->length, blobs);
+        return;
+    }
+
+    BitReader br = {.buf = params, .size = (value->bit_pos + value->length * 8), .pos = value->bit_pos};
+    for (int i = 0; i < value->length; i++)
+        fputc((int)read_bits(&br, 8), blobs);
+}
+
+/* blob file of an output partition (site/day/rop), opened on first use */
+typedef struct BlobOutput
+{
+    FILE *f;
+    long offset; // where the next blob starts
+} BlobOutput;
+
+/* the blob file is truncated together with the csv that holds its offsets */
+bool open_blob_output(BlobOutput *blobs, CTRStruct *head, char *mode)
+{
+    if (blobs->f != NULL)
+        return true;
+
+    char path[1024] = {0};
+    char date[9], rop[5];
+    snprintf(path, sizeof path, blobs_filename_format, output_dir, head->header.ne_logical_label,
+             format_date(date, &head->header.date_time), format_rop(rop, &head->header.date_time));
+
+    blobs->f = fopen(path, strcmp(mode, "w") == 0 ? "wb" : "ab");
+    if (blobs->f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        return false;
+    }
+    fseek(blobs->f, 0L, SEEK_END);
+    blobs->offset = ftell(blobs->f);
+    return true;
+}
+
+typedef struct EventOutput
+{
+    int id; /* key */
+    FILE *f;
+    UT_hash_handle hh;
+} EventOutput;
+
+/* Write the decoded --columns of the events of a file to one csv per event type.
+ * With --blobs byte array params go to the blob file of the partition, written
+ * or appended along with the csv, and the csv only carries their <param>_OFFSET,<param>_LENGTH in that file. */
+int print_events_csv(CTRStruct *node, char *mode)
+{
+    bool result = true;
+    EventOutput *outputs = NULL, *out, *tmp;
+    BlobOutput blobs = {0};
+    CTRStruct *head = node;
+
+    if (node == NULL || node->type != HEADER)
+        return false;
+
+    for (; node != NULL; node = node->next)
+    {
+        if (node->type != EVENT || node->event.values == NULL)
+            continue;
+
+        EventConfig *event = find_pm_event(node->event.id);
+
+        HASH_FIND_INT(outputs, &node->event.id, out);
+        if (out == NULL)
+        {
+            char path[1024] = {0};
+            char date[9], rop[5];
+            snprintf(path, sizeof path, events_filename_format, output_dir, event->name, head->header.ne_logical_label,
+                     format_date(date, &head->header.date_time), format_rop(rop, &head->header.date_time));
+
+            out = malloc(sizeof *out);
+            out->id = node->event.id;
+            out->f = fopen(path, mode);
+            HASH_ADD_INT(outputs, id, out);
+            if (out->f == NULL)
+            {
+                printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+                result = false;
+                continue;
+            }
+
+            if (ftell(out->f) == 0)
+            {
+                fprintf(out->f, "File_Id,Record_Id");
+                for (ParamsList *param = event->params_head; param != NULL; param = param->next)
+                {
+                    if (param->column < 0)
+                        continue;
+                    if (blob_store_flag && param->kind == PARAM_BYTEARRAY)
+                        fprintf(out->f, ",%s_OFFSET,%s_LENGTH", param->name, param->name);
+                    else
+                        fprintf(out->f, ",%s", param->name);
+                }
+                fprintf(out->f, "\n");
+            }
+        }
+        if (out->f == NULL)
+            continue;
+
+        fprintf(out->f, "%d,%d", node->file_id, node->record_id);
+        for (ParamsList *param = event->params_head; param != NULL; param = param->next)
+        {
+            if (param->column < 0)
+                continue;
+            fputc(',', out->f);
+
+            CTRParamValue *value = &node->event.values[param->column];
+            if (blob_store_flag && param->kind == PARAM_BYTEARRAY)
+            {
+                if (value->valid && open_blob_output(&blobs, head, mode))
+                {
+                    write_param_blob(blobs.f, node->event.parameters, value);
+                    fprintf(out->f, "%ld,%u", blobs.offset, (unsigned int)value->length);
+                    blobs.offset += value->length;
+                }
+                else
+                {
+                    fputc(',', out->f);
+                }
+                continue;
+            }
+            print_param_value_csv(out->f, param, node->event.parameters, value);
+        }
+        fputc('\n', out->f);
+    }
+
+    HASH_ITER(hh, outputs, out, tmp)
+    {
+        if (out->f)
+            fclose(out->f);
+        HASH_DEL(outputs, out);
+        free(out);
+    }
+    if (blobs.f)
+        fclose(blobs.f);
+
+    return result;
+}
+
+int print_files_csv(CTRStruct *node, const char *path, char *mode)
+{
+    bool result = true;
+
+    FILE *f = fopen(path, mode);
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        nob_return_defer(false);
+    }
+
+    if (node == NULL)
+        nob_return_defer(false);
+
+    if (strcmp(mode, "w") == 0)
+        fprintf(f, "id, records, parse_datetime, filename, skipped_bytes\n");
+
+    struct tm tm;
+    localtime_r(&node->header.parse_time, &tm);
+    CTRDateTime parse_time = {tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec};
+    char parse_timestamp[20];
+    fprintf(f, "%d,%u,%s,%s,%u\n", node->file_id, (unsigned int)node->header.num_records, format_date_time(parse_timestamp, &parse_time), node->header.file_name, (unsigned int)node->header.skipped_bytes);
+
+defer:
+    if (f)
+        fclose(f);
+    return result;
+}
+
+/*
+ * --latency pairs, one definition per line of the file:
+ *
+ *   <NAME> = <REQUEST_EVENT> -> <RESPONSE_EVENT> by <UE_PARAM> per <CELL_PARAM>
+ *
+ * A request event remembers its time and cell under (pair, UE reference)
+ * until the response event of the same UE comes, or until it is older than
+ * --session-timeout. Latencies go to a histogram per (pair, cell) with
+ * LATENCY_SUB_BUCKETS log-linear buckets per power of 2 of milliseconds, in
+ * a KpiMap per decoder thread merged at the end like the --kpi counters.
+ * Percentiles are bucket upper bounds, at most 1/LATENCY_SUB_BUCKETS high.
+ */
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_MAX_EXPONENT 24 // 2^24 ms, about 4.6 hours, larger values go to the last bucket
+#define LATENCY_BUCKETS (2 * LATENCY_SUB_BUCKETS + (LATENCY_MAX_EXPONENT - 4) * LATENCY_SUB_BUCKETS)
+#define MAX_PENDING_REQUESTS (64 * 1024)
+#define DAY_MS (24 * 60 * 60 * 1000)
+
+typedef struct LatencyPair
+{
+    int index;
+    char name[128];
+    EventConfig *request;
+    EventConfig *response;
+    ParamsList *request_ue, *request_cell;
+    ParamsList *response_ue, *response_cell;
+} LatencyPair;
+
+typedef struct LatencyPairs
+{
+    LatencyPair **items;
+    size_t count;
+    size_t capacity;
+} LatencyPairs;
+
+LatencyPairs latency_pairs = {0};
+
+_Thread_local KpiMap *latency_counters = NULL; // histograms of the file being parsed, NULL without --latency
+KpiMap latency_totals = {0};
+
+typedef struct PendingKey
+{
+    int pair;
+    uint64_t ue;
+} PendingKey;
+
+typedef struct PendingRequest
+{
+    PendingKey key; // memset before filling, the whole struct is hashed
+    int64_t ms;     // since midnight
+    CTRParamValue cell;
+    UT_hash_handle hh;
+} PendingRequest;
+
+/* values below 2 * LATENCY_SUB_BUCKETS get a bucket each, above that 8 buckets per power of 2 */
+int latency_bucket(uint64_t ms)
+{
+    if (ms < 2 * LATENCY_SUB_BUCKETS)
+        return ms;
+
+    int exponent = 63 - __builtin_clzll(ms); // >= 4
+    if (exponent >= LATENCY_MAX_EXPONENT)
+        return LATENCY_BUCKETS - 1;
+    int sub = (ms >> (exponent - 3)) & (LATENCY_SUB_BUCKETS - 1);
+    return 2 * LATENCY_SUB_BUCKETS + (exponent - 4) * LATENCY_SUB_BUCKETS + sub;
+}
+
+/* largest value that falls in the bucket */
+uint64_t latency_bucket_max(int bucket)
+{
+    if (bucket < 2 * LATENCY_SUB_BUCKETS)
+        return bucket;
+
+    int exponent = (bucket - 2 * LATENCY_SUB_BUCKETS) / LATENCY_SUB_BUCKETS + 4;
+    int sub = (bucket - 2 * LATENCY_SUB_BUCKETS) % LATENCY_SUB_BUCKETS;
+    return ((uint64_t)(LATENCY_SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+}
+
+int64_t ctr_time_ms(const CTRTime *t)
+{
+    return ((t->hour * 60 + t->minute) * 60 + t->second) * 1000 + t->millisecond;
+}
+
+void free_pending_requests(PendingRequest **pending)
+{
+    PendingRequest *request, *tmp;
+
+    HASH_ITER(hh, *pending, request, tmp)
+    {
+        HASH_DEL(*pending, request);
+        free(request);
+    }
+}
+
+void expire_pending_requests(PendingRequest **pending, int64_t now)
+{
+    PendingRequest *request, *tmp;
+
+    HASH_ITER(hh, *pending, request, tmp)
+    {
+        if (request->ms + session_timeout_ms < now)
+        {
+            HASH_DEL(*pending, request);
+            free(request);
+        }
+    }
+}
+
+void match_latency(PendingRequest **pending, const uint8_t *buf, uint16_t len)
+{
+    if (len < 4 + 3)
+        return;
+    EventConfig *event = find_pm_event(be32_to_cpu(buf));
+    if (event == NULL)
+        return;
+
+    const uint8_t *params = buf + 3;
+    uint16_t params_len = len - 4 - 3;
+    CTRTime t;
+    bool has_time = false;
+    for (size_t i = 0; i < latency_pairs.count; i++)
+    {
+        LatencyPair *pair = latency_pairs.items[i];
+        bool is_request = event == pair->request;
+        if (!is_request && event != pair->response)
+            continue;
+        if (!has_time && !(has_time = decode_pm_event_timestamp(event, params, params_len, &t)))
+            return;
+
+        PendingKey key;
+        CTRParamValue ue;
+        memset(&key, 0, sizeof key);
+        if (!find_pm_event_param_value(event, is_request ? pair->request_ue : pair->response_ue, params, params_len, &ue) || !ue.valid)
+            continue;
+        key.pair = pair->index;
+        key.ue = ue.value;
+
+        PendingRequest *request;
+        HASH_FIND(hh, *pending, &key, sizeof key, request);
+        if (is_request)
+        {
+            if (request == NULL && HASH_COUNT(*pending) == MAX_PENDING_REQUESTS)
+                expire_pending_requests(pending, ctr_time_ms(&t));
+            if (request == NULL && HASH_COUNT(*pending) == MAX_PENDING_REQUESTS)
+                continue; // dropped, no room
+            if (request == NULL)
+            {
+                request = calloc(1, sizeof *request);
+                request->key = key;
+                HASH_ADD(hh, *pending, key, sizeof key, request);
+            }
+            request->ms = ctr_time_ms(&t); // a repeated request restarts the measurement
+            request->cell.valid = false;
+            if (pair->request_cell)
+                find_pm_event_param_value(event, pair->request_cell, params, params_len, &request->cell);
+            continue;
+        }
+
+        if (request == NULL)
+            continue;
+        HASH_DEL(*pending, request);
+
+        int64_t latency = ctr_time_ms(&t) - request->ms;
+        if (latency < 0)
+            latency += DAY_MS; // across midnight
+        CTRParamValue cell = request->cell;
+        free(request);
+        if (latency > session_timeout_ms)
+            continue;
+        if (!cell.valid && pair->response_cell)
+            find_pm_event_param_value(event, pair->response_cell, params, params_len, &cell);
+        if (!cell.valid)
+            continue;
+
+        KpiSlot *slot = kpi_map_find(latency_counters, pair->index + 1, 0, cell.value);
+        kpi_slot_bins(slot, LATENCY_BUCKETS);
+        slot->count++;
+        slot->bins[latency_bucket(latency)]++;
+    }
+}
+
+int load_latency_definitions(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_no = 0;
+    while (getline(&line, &line_size, f) > 0)
+    {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *text = line + strspn(line, " \t");
+        if (*text == '\0' || *text == '#')
+            continue;
+
+        char name[128], request[128], response[128], ue[128], cell[128];
+        int n = 0;
+        if (sscanf(text, "%127s = %127s -> %127s by %127s per %127s %n", name, request, response, ue, cell, &n) != 5 || text[n] != '\0')
+            kpi_definition_error(path, line_no, "expected '<NAME> = <REQUEST> -> <RESPONSE> by <UE_PARAM> per <CELL_PARAM>', got", text);
+
+        LatencyPair *pair = calloc(1, sizeof *pair);
+        pair->index = latency_pairs.count;
+        strcpy(pair->name, name);
+        pair->request = find_pm_event_by_name(request);
+        if (pair->request == NULL)
+            kpi_definition_error(path, line_no, "event not in the config:", request);
+        pair->response = find_pm_event_by_name(response);
+        if (pair->response == NULL)
+            kpi_definition_error(path, line_no, "event not in the config:", response);
+
+        pair->request_ue = find_pm_event_param_by_name(pair->request, ue);
+        pair->response_ue = find_pm_event_param_by_name(pair->response, ue);
+        if (pair->request_ue == NULL || pair->response_ue == NULL)
+            kpi_definition_error(path, line_no, "param not in both events:", ue);
+        pair->request_cell = find_pm_event_param_by_name(pair->request, cell);
+        pair->response_cell = find_pm_event_param_by_name(pair->response, cell);
+        if (pair->request_cell == NULL && pair->response_cell == NULL)
+            kpi_definition_error(path, line_no, "param not in either event:", cell);
+
+        nob_da_append(&latency_pairs, pair);
+    }
+    free(line);
+    fclose(f);
+
+    printf("[ CFG ]: %zu latency pairs loaded from %s\n", latency_pairs.count, path);
+    return EXIT_SUCCESS;
+}
+
+/* smallest bucket bound with at least percentile of the samples at or below it */
+uint64_t latency_percentile(KpiSlot *slot, double percentile)
+{
+    uint64_t rank = (uint64_t)(percentile * slot->count + 0.999999);
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+    {
+        seen += slot->bins[bucket];
+        if (seen >= rank && seen > 0)
+            return latency_bucket_max(bucket);
+    }
+    return latency_bucket_max(LATENCY_BUCKETS - 1);
+}
+
+int print_latency_csv()
+{
+    bool result = true;
+    char path[500] = {0};
+    sprintf(path, latency_filename_format, output_dir);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        nob_return_defer(false);
+    }
+
+    size_t rows = kpi_map_sort(&latency_totals);
+
+    fprintf(f, "latency,request_event,response_event,cell,samples,p50_ms,p90_ms,p95_ms,p99_ms,max_ms\n");
+    for (size_t i = 0; i < rows; i++)
+    {
+        KpiSlot *slot = &latency_totals.slots[i];
+        LatencyPair *pair = latency_pairs.items[slot->kpi - 1];
+        fprintf(f, "%s,%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", pair->name, pair->request->name, pair->response->name,
+                (unsigned long long)slot->group, (unsigned long long)slot->count,
+                (unsigned long long)latency_percentile(slot, 0.50), (unsigned long long)latency_percentile(slot, 0.90),
+                (unsigned long long)latency_percentile(slot, 0.95), (unsigned long long)latency_percentile(slot, 0.99),
+                (unsigned long long)latency_percentile(slot, 1.0));
+    }
+    printf("[ INF ]: %zu latency histograms written to %s\n", rows, path);
+
+defer:
+    if (f)
+        fclose(f);
+    return result;
+}
+
+/*
+ * --sessions <PARAM>: events of a file carrying the same UE reference are
+ * folded into a session in a hash table of at most MAX_SESSIONS entries. The
+ * sessions are also kept in a list by last event time, so the ones idle for
+ * longer than --session-timeout are closed from its front as the events go
+ * by, and the oldest is closed early when the table is full. A closed
+ * session becomes a summary row; the rows of a file are written by the
+ * writer to ctr_sessions.csv. UE references are only unique within a node,
+ * so sessions do not continue across files.
+ */
+#define MAX_SESSIONS (64 * 1024)
+
+typedef struct SessionRow
+{
+    uint64_t ue;
+    int64_t start_ms; // since midnight of the first event
+    int64_t end_ms;
+    uint32_t events;
+    uint32_t procedures; // INTERNAL_PROC_* events
+    EventConfig *first_event;
+    EventConfig *last_event; // the outcome, e.g. INTERNAL_PROC_UE_CTXT_RELEASE
+    const char *end_reason;
+} SessionRow;
+
+typedef struct SessionRows
+{
+    SessionRow *items;
+    size_t count;
+    size_t capacity;
+} SessionRows;
+
+typedef struct Session
+{
+    SessionRow row;
+    struct Session *prev, *next; // by last event time
+    UT_hash_handle hh;
+} Session;
+
+typedef struct SessionTable
+{
+    Session *hash;
+    Session *oldest;
+    Session *newest;
+    int64_t day_offset_ms; // events after midnight keep counting up
+    int64_t last_ms;
+    SessionRows *rows;
+} SessionTable;
+
+void resolve_session_key(const char *name)
+{
+    EventConfig *event, *tmp;
+    int events = 0;
+
+    HASH_ITER(hh, event_hash, event, tmp)
+    {
+        event->session_param = find_pm_event_param_by_name(event, name);
+        events += event->session_param != NULL;
+    }
+    if (events == 0)
+    {
+        printf("[ ERR ]: No event has the session param %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    printf("[ CFG ]: Sessions keyed on %s of %d events\n", name, events);
+}
+
+void session_unlink(SessionTable *table, Session *session)
+{
+    if (session->prev)
+        session->prev->next = session->next;
+    else
+        table->oldest = session->next;
+    if (session->next)
+        session->next->prev = session->prev;
+    else
+        table->newest = session->prev;
+    session->prev = session->next = NULL;
+}
+
+void session_append(SessionTable *table, Session *session)
+{
+    session->prev = table->newest;
+    if (table->newest)
+        table->newest->next = session;
+    else
+        table->oldest = session;
+    table->newest = session;
+}
+
+void session_close(SessionTable *table, Session *session, const char *reason)
+{
+    session_unlink(table, session);
+    HASH_DEL(table->hash, session);
+    session->row.end_reason = reason;
+    nob_da_append(table->rows, session->row);
+    free(session);
+}
+
+void correlate_event(SessionTable *table, const uint8_t *buf, uint16_t len)
+{
+    if (len < 4 + 3)
+        return;
+    EventConfig *event = find_pm_event(be32_to_cpu(buf));
+    if (event == NULL || event->session_param == NULL)
+        return;
+
+    const uint8_t *params = buf + 3;
+    uint16_t params_len = len - 4 - 3;
+    CTRParamValue ue;
+    CTRTime t;
+    if (!find_pm_event_param_value(event, event->session_param, params, params_len, &ue) || !ue.valid ||
+        !decode_pm_event_timestamp(event, params, params_len, &t))
+        return;
+
+    int64_t now = ((t.hour * 60 + t.minute) * 60 + t.second) * 1000 + t.millisecond + table->day_offset_ms;
+    if (now < table->last_ms - DAY_MS / 2)
+    {
+        table->day_offset_ms += DAY_MS;
+        now += DAY_MS;
+    }
+    table->last_ms = now;
+
+    while (table->oldest && table->oldest->row.end_ms + session_timeout_ms < now)
+        session_close(table, table->oldest, "timeout");
+
+    Session *session;
+    HASH_FIND(hh, table->hash, &ue.value, sizeof ue.value, session);
+    if (session == NULL)
+    {
+        if (HASH_COUNT(table->hash) == MAX_SESSIONS)
+            session_close(table, table->oldest, "evicted");
+
+        session = calloc(1, sizeof *session);
+        session->row.ue = ue.value;
+        session->row.start_ms = now;
+        session->row.first_event = event;
+        HASH_ADD(hh, table->hash, row.ue, sizeof session->row.ue, session);
+    }
+    else
+        session_unlink(table, session);
+    session_append(table, session);
+
+    session->row.end_ms = now;
+    session->row.events++;
+    session->row.procedures += strncmp(event->name, "INTERNAL_PROC_", 14) == 0;
+    session->row.last_event = event;
+}
+
+/* close the sessions still open at the end of the file, oldest first */
+void correlate_end(SessionTable *table, const char *reason)
+{
+    while (table->oldest)
+        session_close(table, table->oldest, reason);
+}
+
+void format_session_time(char *out, int64_t ms)
+{
+    CTRTime t = {ms / 3600000 % 24, ms / 60000 % 60, ms / 1000 % 60, ms % 1000};
+    format_time(out, &t);
+}
+
+int print_sessions_csv(CTRStruct *head, char *mode)
+{
+    bool result = true;
+    char path[500] = {0};
+    sprintf(path, sessions_filename_format, output_dir);
+
+    FILE *f = fopen(path, mode);
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        nob_return_defer(false);
+    }
+
+    if (strcmp(mode, "w") == 0)
+        fprintf(f, "file_id,ne_logical_label,ue,start,end,duration_ms,events,procedures,first_event,last_event,end_reason\n");
+
+    SessionRows *rows = head->header.sessions;
+    for (size_t i = 0; rows != NULL && i < rows->count; i++)
+    {
+        SessionRow *row = &rows->items[i];
+        char start[13], end[13];
+        format_session_time(start, row->start_ms);
+        format_session_time(end, row->end_ms);
+        fprintf(f, "%d,\"%s\",%llu,%s,%s,%lld,%u,%u,%s,%s,%s\n", head->file_id, head->header.ne_logical_label,
+                (unsigned long long)row->ue, start, end, (long long)(row->end_ms - row->start_ms), row->events,
+                row->procedures, row->first_event->name, row->last_event->name, row->end_reason);
+    }
+
+defer:
+    if (f)
+        fclose(f);
+    return result;
+}
+
+void free_session_rows(SessionRows **rows)
+{
+    if (*rows == NULL)
+        return;
+    nob_da_free(**rows);
+    free(*rows);
+    *rows = NULL;
+}
+
+/*
+ * --sample N: keep the events of a UE when the hash of its UE param falls in
+ * 1 of N buckets. The hash only depends on the value, so the same UEs are
+ * kept in every file and run, with all of their events. Events without the
+ * param are not about a UE and are all kept, events with an invalid value
+ * are dropped. Only the one param is decoded, before anything else looks
+ * at the event.
+ */
+void resolve_sample_param(const char *name)
+{
+    EventConfig *event, *tmp;
+    int events = 0;
+
+    HASH_ITER(hh, event_hash, event, tmp)
+    {
+        event->sample_param = find_pm_event_param_by_name(event, name);
+        events += event->sample_param != NULL;
+    }
+    if (events == 0)
+    {
+        printf("[ ERR ]: No event has the sample param %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    printf("[ CFG ]: Sampling 1 in %d UEs on %s of %d events\n", sample_rate, name, events);
+}
+
+bool ue_sampled(const uint8_t *buf, uint16_t len)
+{
+    if (len < 4 + 3)
+        return true; // no params, not about a UE
+    EventConfig *event = find_pm_event(be32_to_cpu(buf));
+    if (event == NULL || event->sample_param == NULL)
+        return true;
+
+    CTRParamValue ue;
+    if (!find_pm_event_param_value(event, event->sample_param, buf + 3, len - 4 - 3, &ue) || !ue.valid)
+        return false;
+    return hash_u64(ue.value) % sample_rate == 0;
+}
+
+/*
+ * --aggregate: decoders count the events of each file by id in a small
+ * table hung off the header, the writer merges it into the run wide table
+ * keyed by (ne_logical_label, date, rop, event id) and writes that table to
+ * ctr_aggregate.csv at the end instead of a row per record.
+ */
+typedef struct EventCount
+{
+    int id;
+    uint64_t events;
+    uint64_t bytes;
+    UT_hash_handle hh;
+} EventCount;
+
+typedef struct AggregateKey
+{
+    uint8_t ne_logical_label[256];
+    char date[9];
+    char rop[5];
+    int event_id;
+} AggregateKey;
+
+typedef struct Aggregate
+{
+    AggregateKey key; // memset before filling, the whole struct is hashed
+    uint64_t events;
+    uint64_t bytes;
+    UT_hash_handle hh;
+} Aggregate;
+
+Aggregate *aggregates = NULL;
+
+void count_event(EventCount **counts, int id, uint16_t len)
+{
+    EventCount *count;
+
+    HASH_FIND_INT(*counts, &id, count);
+    if (count == NULL)
+    {
+        count = calloc(1, sizeof *count);
+        count->id = id;
+        HASH_ADD_INT(*counts, id, count);
+    }
+    count->events++;
+    count->bytes += len;
+}
+
+void free_event_counts(EventCount **counts)
+{
+    EventCount *count, *tmp;
+
+    HASH_ITER(hh, *counts, count, tmp)
+    {
+        HASH_DEL(*counts, count);
+        free(count);
+    }
+}
+
+/* move the counts of a parsed file into the run wide table */
+void merge_event_counts(CTRHeader *header)
+{
+    EventCount *count, *tmp;
+    AggregateKey key;
+
+    memset(&key, 0, sizeof key);
+    memcpy(key.ne_logical_label, header->ne_logical_label, sizeof key.ne_logical_label);
+    format_date(key.date, &header->date_time);
+    format_rop(key.rop, &header->date_time);
+
+    HASH_ITER(hh, header->event_counts, count, tmp)
+    {
+        Aggregate *aggregate;
+        key.event_id = count->id;
+        HASH_FIND(hh, aggregates, &key, sizeof key, aggregate);
+        if (aggregate == NULL)
+        {
+            aggregate = calloc(1, sizeof *aggregate);
+            aggregate->key = key;
+            HASH_ADD(hh, aggregates, key, sizeof key, aggregate);
+        }
+        aggregate->events += count->events;
+        aggregate->bytes += count->bytes;
+    }
+    free_event_counts(&header->event_counts);
+}
+
+int compare_aggregates(Aggregate *a, Aggregate *b)
+{
+    int cmp = strcmp((char *)a->key.ne_logical_label, (char *)b->key.ne_logical_label);
+    if (cmp == 0)
+        cmp = strcmp(a->key.date, b->key.date);
+    if (cmp == 0)
+        cmp = strcmp(a->key.rop, b->key.rop);
+    if (cmp == 0)
+        cmp = (a->key.event_id > b->key.event_id) - (a->key.event_id < b->key.event_id);
+    return cmp;
+}
+
+int print_aggregate_csv()
+{
+    bool result = true;
+    char path[500] = {0};
+    sprintf(path, aggregate_filename_format, output_dir);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        nob_return_defer(false);
+    }
+
+    HASH_SORT(aggregates, compare_aggregates);
+
+    fprintf(f, "ne_logical_label,date,rop,event_id,event_name,events,bytes\n");
+    Aggregate *aggregate;
+    for (aggregate = aggregates; aggregate != NULL; aggregate = aggregate->hh.next)
+    {
+        EventConfig *event = find_pm_event(aggregate->key.event_id);
+        fprintf(f, "\"%s\",%s,%s,%d,%s,%llu,%llu\n", aggregate->key.ne_logical_label, aggregate->key.date, aggregate->key.rop,
+                aggregate->key.event_id, event ? event->name : "", (unsigned long long)aggregate->events, (unsigned long long)aggregate->bytes);
+    }
+    printf("[ INF ]: %u aggregates written to %s\n", HASH_COUNT(aggregates), path);
+
+defer:
+    if (f)
+        fclose(f);
+    return result;
+}
+
+/*
+ * Spilled runs, shared by --merge and --timeline: entries in time order are
+ * appended to a temporary file as a run, the key as delta to the entry before
+ * and every field varint coded. A heap merge reads the runs back through a
+ * small buffer each, so memory depends on the number of runs, not their size.
+ */
+typedef struct RunEntry
+{
+    uint64_t key; // ms since epoch with the sign bit flipped, sorts as unsigned
+    uint32_t site; // index in timeline.names, --timeline only
+    int32_t file_id;
+    int32_t event_id;
+    uint16_t length;
+    uint8_t type; // enum RecordType
+} RunEntry;
+
+#define RUN_BUFFER 4096
+#define TIME_KEY_BIAS (1ULL << 63)
+
+typedef struct SpillRun
+{
+    int fd;
+    off_t offset; // next byte of the run in the spill file
+    size_t left;  // entries not yet read
+    RunEntry entry;
+    int index; // spill order, breaks ties
+    uint8_t *buf; // RUN_BUFFER bytes while the run is merged
+    size_t buf_len;
+    size_t buf_pos;
+} SpillRun;
+
+FILE *spill_open(const char *what)
+{
+    FILE *f = tmpfile();
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not create a temporary file for the %s: %s\n", what, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return f;
+}
+
+void put_varint(FILE *f, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        putc_unlocked((value & 0x7f) | 0x80, f);
+        value >>= 7;
+    }
+    putc_unlocked(value, f);
+}
+
+/* append n sorted entries to the spill file as one run */
+SpillRun spill_run(FILE *spill, const RunEntry *items, size_t n, int index)
+{
+    SpillRun run = {.fd = fileno(spill), .offset = ftello(spill), .left = n, .index = index};
+    uint64_t key = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        put_varint(spill, items[i].key - key);
+        put_varint(spill, items[i].site);
+        put_varint(spill, items[i].file_id);
+        put_varint(spill, items[i].event_id);
+        put_varint(spill, items[i].length);
+        put_varint(spill, items[i].type);
+        key = items[i].key;
+    }
+    return run;
+}
+
+int run_getc(SpillRun *run)
+{
+    if (run->buf_pos == run->buf_len)
+    {
+        ssize_t n = pread(run->fd, run->buf, RUN_BUFFER, run->offset);
+        if (n <= 0)
+            return EOF;
+        run->offset += n;
+        run->buf_len = n;
+        run->buf_pos = 0;
+    }
+    return run->buf[run->buf_pos++];
+}
+
+uint64_t get_varint(SpillRun *run)
+{
+    uint64_t value = 0;
+    int c;
+    for (int shift = 0; (c = run_getc(run)) != EOF; shift += 7)
+    {
+        value |= (uint64_t)(c & 0x7f) << shift;
+        if (c < 0x80)
+            break;
+    }
+    return value;
+}
+
+bool run_next(SpillRun *run)
+{
+    if (run->left == 0)
+        return false;
+    run->left--;
+    run->entry.key += get_varint(run);
+    run->entry.site = get_varint(run);
+    run->entry.file_id = get_varint(run);
+    run->entry.event_id = get_varint(run);
+    run->entry.length = get_varint(run);
+    run->entry.type = get_varint(run);
+    return true;
+}
+
+bool run_less(const SpillRun *a, const SpillRun *b)
+{
+    return a->entry.key < b->entry.key || (a->entry.key == b->entry.key && a->index < b->index);
+}
+
+void run_sift_down(SpillRun **heap, size_t n, size_t i)
+{
+    for (;;)
+    {
+        size_t least = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < n && run_less(heap[left], heap[least]))
+            least = left;
+        if (right < n && run_less(heap[right], heap[least]))
+            least = right;
+        if (least == i)
+            return;
+        SpillRun *tmp = heap[i];
+        heap[i] = heap[least];
+        heap[least] = tmp;
+        i = least;
+    }
+}
+
+/* k-way merge of spilled runs, print is called for every entry in time order */
+void merge_runs(FILE *spill, SpillRun *runs, size_t n_runs, FILE *out, void (*print)(FILE *, const RunEntry *))
+{
+    fflush(spill);
+
+    SpillRun **heap = malloc(n_runs * sizeof *heap);
+    size_t n = 0;
+    for (size_t i = 0; i < n_runs; i++)
+    {
+        runs[i].buf = malloc(RUN_BUFFER);
+        if (run_next(&runs[i]))
+            heap[n++] = &runs[i];
+    }
+    for (size_t i = n / 2; i-- > 0;)
+        run_sift_down(heap, n, i);
+
+    while (n > 0)
+    {
+        print(out, &heap[0]->entry);
+        if (!run_next(heap[0]))
+            heap[0] = heap[--n];
+        run_sift_down(heap, n, 0);
+    }
+
+    for (size_t i = 0; i < n_runs; i++)
+        free(runs[i].buf);
+    free(heap);
+}
+
+/* yyyymmdd and hh:mm:ss:mmm of a time key */
+void format_time_key(char *date, char *time, uint64_t key)
+{
+    int64_t ms = (int64_t)(key ^ TIME_KEY_BIAS);
+    time_t seconds = ms / 1000;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+
+    CTRDateTime day = {.year = tm.tm_year + 1900, .month = tm.tm_mon + 1, .day = tm.tm_mday};
+    format_date(date, &day);
+    format_session_time(time, ms);
+}
+
+/*
+ * --merge: instead of a records csv per file the writer turns every parsed
+ * file into a run of (time, record) entries in the spill file and frees it,
+ * the records of a file are already in time order. At the end the runs of
+ * each site are merged by time into ctr_merged_<site>.csv.
+ * Records without a timestamp keep the time of the record before them.
+ */
+typedef struct MergeCursor
+{
+    int64_t time; // ms since epoch of node
+    CTRStruct *node;
+    int64_t file_start; // ms since epoch of the header date and rop
+    int64_t day_start;  // midnight of the file start, event times are only hh:mm:ss.ms
+} MergeCursor;
+
+typedef struct MergeSite
+{
+    char site[256]; // ne_logical_label
+    SpillRun *runs; // a run per file, in input order
+    size_t n_runs;
+    uint64_t records;
+    UT_hash_handle hh;
+} MergeSite;
+
+MergeSite *merge_sites = NULL;
+FILE *merge_spill = NULL;
+
+int64_t merge_record_time(MergeCursor *cursor)
+{
+    CTRStruct *node = cursor->node;
+    int64_t time = cursor->time;
+
+    switch (node->type)
+    {
+    case HEADER:
+        time = cursor->file_start;
+        break;
+    case SCANNER:
+        time = cursor->day_start + ctr_time_ms(&node->scanner.timestamp);
+        break;
+    case EVENT:
+        if (node->event.has_timestamp)
+            time = cursor->day_start + ctr_time_ms(&node->event.timestamp);
+        break;
+    case FOOTER:
+        time = ctr_date_time_epoch_ms(&node->footer.date_time);
+        break;
+    }
+
+    if (time < cursor->file_start - DAY_MS / 2)
+        time += DAY_MS; // the rop runs past midnight
+    return time > cursor->time ? time : cursor->time;
+}
+
+MergeCursor merge_cursor(CTRStruct *head)
+{
+    CTRDateTime *start = &head->header.date_time;
+    return (MergeCursor){
+        .time = INT64_MIN,
+        .file_start = ctr_date_time_epoch_ms(start),
+        .day_start = days_from_civil(start->year, start->month, start->day) * DAY_MS,
+    };
+}
+
+RunEntry record_run_entry(MergeCursor *cursor)
+{
+    CTRStruct *node = cursor->node;
+    RunEntry entry = {.key = (uint64_t)cursor->time ^ TIME_KEY_BIAS, .file_id = node->file_id, .type = node->type};
+    switch (node->type)
+    {
+    case HEADER:
+        entry.length = node->header.length;
+        break;
+    case SCANNER:
+        entry.length = node->scanner.length;
+        break;
+    case EVENT:
+        entry.length = node->event.length;
+        entry.event_id = node->event.id;
+        break;
+    case FOOTER:
+        entry.length = node->footer.length;
+        break;
+    }
+    return entry;
+}
+
+void merge_add_file(CTRStruct *head)
+{
+    static RunEntry *entries = NULL;
+    static size_t capacity = 0;
+    size_t n = 0;
+
+    if (merge_spill == NULL)
+        merge_spill = spill_open("merge");
+
+    MergeCursor cursor = merge_cursor(head);
+    for (cursor.node = head; cursor.node != NULL; cursor.node = cursor.node->next)
+    {
+        cursor.time = merge_record_time(&cursor);
+        if (n == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 1024;
+            entries = realloc(entries, capacity * sizeof *entries);
+        }
+        entries[n++] = record_run_entry(&cursor);
+    }
+
+    MergeSite *site;
+    HASH_FIND_STR(merge_sites, (char *)head->header.ne_logical_label, site);
+    if (site == NULL)
+    {
+        site = calloc(1, sizeof *site);
+        strcpy(site->site, (char *)head->header.ne_logical_label);
+        HASH_ADD_STR(merge_sites, site, site);
+    }
+    site->runs = realloc(site->runs, (site->n_runs + 1) * sizeof *site->runs);
+    site->runs[site->n_runs] = spill_run(merge_spill, entries, n, site->n_runs);
+    site->n_runs++;
+    site->records += n;
+}
+
+void print_merged_entry(FILE *f, const RunEntry *entry)
+{
+    static const char *type_names[] = {[HEADER] = "HEADER", [SCANNER] = "SCANNER", [EVENT] = "EVENT", [FOOTER] = "FOOTER"};
+    char date[9], time[13];
+    format_time_key(date, time, entry->key);
+
+    fprintf(f, "%s,%s,%d,%s,%d", date, time, entry->file_id, type_names[entry->type], entry->length);
+    if (entry->type == EVENT)
+    {
+        const char *name = get_pm_event_name_by_id(entry->event_id);
+        fprintf(f, ",%d,%s", entry->event_id, name ? name : "");
+    }
+    fprintf(f, "\n");
+}
+
+int strcmp_merge_sites(MergeSite *a, MergeSite *b)
+{
+    return strcmp(a->site, b->site);
+}
+
+int print_merged_csv(MergeSite *site)
+{
+    bool result = true;
+    char path[500] = {0};
+    sprintf(path, merged_filename_format, output_dir, site->site);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        nob_return_defer(false);
+    }
+
+    fprintf(f, "Date,Time,File_Id,Event_Name,Event_Size_bytes,Event_Id,Event_name\n");
+    merge_runs(merge_spill, site->runs, site->n_runs, f, print_merged_entry);
+    printf("[ INF ]: %llu records of %zu files merged to %s\n", (unsigned long long)site->records, site->n_runs, path);
+
+defer:
+    if (f)
+        fclose(f);
+    return result;
+}
+
+void print_merged_sites()
+{
+    MergeSite *site, *tmp;
+
+    HASH_SORT(merge_sites, strcmp_merge_sites);
+    HASH_ITER(hh, merge_sites, site, tmp)
+    {
+        print_merged_csv(site);
+        HASH_DEL(merge_sites, site);
+        free(site->runs);
+        free(site);
+    }
+    fclose(merge_spill);
+    merge_spill = NULL;
+}
+
+/*
+ * --timeline: every event of the run, all sites, sorted by time. The writer
+ * collects the events into a run of --timeline-run entries, radix sorts it
+ * on the time key and spills it. At the end the runs are merged; when
+ * everything fit in one run it is written straight from memory.
+ */
+typedef struct TimelineSite
+{
+    char site[256];
+    uint32_t index;
+    UT_hash_handle hh;
+} TimelineSite;
+
+typedef struct Timeline
+{
+    RunEntry *items; // current run
+    size_t count;
+    RunEntry *scratch;
+    FILE *spill;
+    SpillRun *runs; // spilled
+    size_t n_runs;
+    TimelineSite *sites;
+    char **names; // by site index
+    uint32_t n_sites;
+    uint64_t events;
+} Timeline;
+
+Timeline timeline = {0};
+
+/*
+ * LSD radix sort on the key, a byte per pass; stable, so equal times keep the
+ * input order. Passes swap between items and scratch, returns the one holding
+ * the sorted entries.
+ */
+RunEntry *timeline_radix_sort(RunEntry *items, RunEntry *scratch, size_t n)
+{
+    if (n == 0)
+        return items;
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t offsets[256] = {0};
+        for (size_t i = 0; i < n; i++)
+            offsets[(items[i].key >> shift) & 0xff]++;
+        if (offsets[(items[0].key >> shift) & 0xff] == n)
+            continue; // every key has the same byte here
+
+        size_t sum = 0;
+        for (int b = 0; b < 256; b++)
+        {
+            size_t count = offsets[b];
+            offsets[b] = sum;
+            sum += count;
+        }
+        for (size_t i = 0; i < n; i++)
+            scratch[offsets[(items[i].key >> shift) & 0xff]++] = items[i];
+
+        RunEntry *tmp = items;
+        items = scratch;
+        scratch = tmp;
+    }
+    return items;
+}
+
+void timeline_spill()
+{
+    RunEntry *sorted = timeline_radix_sort(timeline.items, timeline.scratch, timeline.count);
+
+    if (timeline.spill == NULL)
+        timeline.spill = spill_open("timeline");
+    timeline.runs = realloc(timeline.runs, (timeline.n_runs + 1) * sizeof *timeline.runs);
+    timeline.runs[timeline.n_runs] = spill_run(timeline.spill, sorted, timeline.count, timeline.n_runs);
+    timeline.n_runs++;
+    timeline.count = 0;
+}
+
+uint32_t timeline_site(const char *name)
+{
+    TimelineSite *site;
+
+    HASH_FIND_STR(timeline.sites, name, site);
+    if (site == NULL)
+    {
+        site = calloc(1, sizeof *site);
+        strcpy(site->site, name);
+        site->index = timeline.n_sites++;
+        HASH_ADD_STR(timeline.sites, site, site);
+        timeline.names = realloc(timeline.names, timeline.n_sites * sizeof *timeline.names);
+        timeline.names[site->index] = site->site;
+    }
+    return site->index;
+}
+
+void timeline_add_file(CTRStruct *head)
+{
+    if (timeline.items == NULL)
+    {
+        timeline.items = malloc(timeline_run * sizeof *timeline.items);
+        timeline.scratch = malloc(timeline_run * sizeof *timeline.scratch);
+    }
+
+    MergeCursor cursor = merge_cursor(head);
+    uint32_t site = timeline_site((char *)head->header.ne_logical_label);
+
+    for (cursor.node = head; cursor.node != NULL; cursor.node = cursor.node->next)
+    {
+        cursor.time = merge_record_time(&cursor);
+        if (cursor.node->type != EVENT)
+            continue;
+
+        if (timeline.count == (size_t)timeline_run)
+            timeline_spill();
+        RunEntry *entry = &timeline.items[timeline.count++];
+        *entry = record_run_entry(&cursor);
+        entry->site = site;
+        timeline.events++;
+    }
+}
+
+void print_timeline_entry(FILE *f, const RunEntry *entry)
+{
+    char date[9], time[13];
+    format_time_key(date, time, entry->key);
+    const char *name = get_pm_event_name_by_id(entry->event_id);
+    fprintf(f, "%s,%s,\"%s\",%d,%d,%d,%s\n", date, time, timeline.names[entry->site], entry->file_id,
+            entry->length, entry->event_id, name ? name : "");
+}
+
+int print_timeline_csv()
+{
+    bool result = true;
+    char path[500] = {0};
+    sprintf(path, timeline_filename_format, output_dir);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
+        nob_return_defer(false);
+    }
+
+    fprintf(f, "Date,Time,Site,File_Id,Event_Size_bytes,Event_Id,Event_name\n");
+    if (timeline.n_runs == 0)
+    {
+        RunEntry *sorted = timeline_radix_sort(timeline.items, timeline.scratch, timeline.count);
+        for (size_t i = 0; i < timeline.count; i++)
+            print_timeline_entry(f, &sorted[i]);
+        printf("[ INF ]: %llu events sorted to %s\n", (unsigned long long)timeline.events, path);
+        nob_return_defer(true);
+    }
+
+    if (timeline.count > 0)
+        timeline_spill();
+    merge_runs(timeline.spill, timeline.runs, timeline.n_runs, f, print_timeline_entry);
+    printf("[ INF ]: %llu events sorted in %zu runs to %s\n", (unsigned long long)timeline.events, timeline.n_runs, path);
+
+defer:
+    if (f)
+        fclose(f);
+    if (timeline.spill)
+        fclose(timeline.spill);
+    free(timeline.items);
+    free(timeline.scratch);
+    free(timeline.runs);
+    timeline.items = timeline.scratch = NULL;
+    timeline.runs = NULL;
+    return result;
+}
+
+/* Walk the records of an open CTR file. Corrupt framing is either skipped by
+ * resynchronising on the next plausible record or quarantines the whole file.
+ * Returns NULL when the file is empty or quarantined. */
+CTRStruct *parse_file(FILE *file, const char *path, const char *file_name, int file_id)
+{
+    static _Thread_local uint8_t record_buf[UINT16_MAX]; // record payload, lengths are 16 bits
+    CTRStruct *head = NULL;
+    CTRStruct *node = NULL;
+    CTRStruct *tail = NULL;
+    EventCount *event_counts = NULL;
+    SessionTable sessions = {0};
+    PendingRequest *pending_requests = NULL;
+
+    long file_size = get_file_lenght(file);
+    if (file_size > 0)
+    {
+        printf("[ INF ]: File #%03d:  %s\n", file_id, path);
+        printf("[ INF ]: File #%03d:  Size - %s\n", file_id, calculateSize(file_size));
+    }
+    else
+    {
+        printf("[ ERR ]: File is empty\n");
+        return NULL;
+    }
+
+    long file_lenght = file_size;
+    int num_records = 0;
+    int skipped_records = 0;
+    int sampled_out = 0;
+    long skipped_bytes = 0;
+    while (file_lenght > 0 && num_records < max_records)
+    {
+        long record_pos = file_size - file_lenght;
+        uint16_t record_lenght = 0;
+        uint16_t record_type = 255;
+        enum FramingError error = read_record_len_type(&record_lenght, &record_type, file, file_lenght, head == NULL);
+
+        if (error == FRAMING_OK && record_type == EVENT && event_filter_flag && skip_filtered_event(record_lenght, file))
+        {
+            num_records++;
+            skipped_records++;
+            file_lenght = file_lenght - record_lenght;
+            continue;
+        }
+
+        if (error == FRAMING_OK && read_record_payload(record_buf, record_lenght, file) != EXIT_SUCCESS)
+            error = FRAMING_SHORT_READ;
+
+        if (error != FRAMING_OK)
+        {
+            if (on_error == ON_ERROR_QUARANTINE || head == NULL)
+            {
+                quarantine_file(path, record_pos, head == NULL ? "no header record" : framing_error_str(error));
+                free_event_counts(&event_counts);
+                correlate_end(&sessions, "quarantined");
+                free_session_rows(&sessions.rows);
+                free_pending_requests(&pending_requests);
+                return NULL;
+            }
+
+            long next = find_record_boundary(file, record_pos + 1, file_size);
+            long skipped = (next < 0 ? file_size : next) - record_pos;
+            printf("[ WRN ]: File #%03d:  %s at offset %ld, skipped %ld bytes\n", file_id, framing_error_str(error), record_pos, skipped);
+            skipped_bytes += skipped;
+            file_lenght -= skipped;
+            fseek(file, file_size - file_lenght, SEEK_SET);
+            continue;
+        }
+        num_records++;
+
+        if (record_type == EVENT && sample_rate > 1 && !ue_sampled(record_buf, record_lenght))
+        {
+            sampled_out++;
+            file_lenght = file_lenght - record_lenght;
+            continue;
+        }
+
+        if (record_type == EVENT && event_predicate && !event_predicate_match(record_buf, record_lenght))
+        {
+            skipped_records++;
+            file_lenght = file_lenght - record_lenght;
+            continue;
+        }
+
+        if (record_type == EVENT && kpi_counters != NULL)
+            count_kpis(record_buf, record_lenght);
+
+        if (record_type == EVENT && sessions.rows != NULL)
+            correlate_event(&sessions, record_buf, record_lenght);
+
+        if (record_type == EVENT && latency_counters != NULL)
+            match_latency(&pending_requests, record_buf, record_lenght);
+
+        if (record_type == EVENT && aggregate_flag && head != NULL)
+        {
+            count_event(&event_counts, be32_to_cpu(record_buf), record_lenght);
+            file_lenght = file_lenght - record_lenght;
+            continue;
+        }
+
+        node = add_record(num_records, record_type, record_lenght, record_buf, file_id);
+
+        if (record_type == HEADER)
+        {
+            head = tail = node;
+            strcpy((char *)node->header.file_name, file_name);
+            kpi_rop_time = node->header.date_time;
+            kpi_rop_seconds = ctr_file_rop_seconds(file_name);
+            if (kpi_counters && kpi_bin_seconds > kpi_rop_seconds)
+                printf("[ WRN ]: File #%03d:  --kpi-bin %d is longer than the %d second rop, counted in one bin\n",
+                       file_id, kpi_bin_seconds, kpi_rop_seconds);
+
+            if (!header_selected(&node->header))
+            {
+                printf("[ INF ]: File #%03d:  Skipped, header outside of --from/--to/--site\n", file_id);
+                free_events(node);
+                return NULL;
+            }
+            if (session_key_arg)
+                sessions.rows = calloc(1, sizeof(SessionRows));
+        }
+        else
+        {
+            tail->next = node;
+            tail = node;
+        }
+
+        file_lenght = file_lenght - record_lenght;
+    }
+    printf("[ INF ]: File #%03d:  Records - %d processed\n", file_id, num_records);
+    if (event_filter_flag || event_predicate)
+        printf("[ INF ]: File #%03d:  Records - %d skipped by event filter\n", file_id, skipped_records);
+    if (sample_rate > 1)
+        printf("[ INF ]: File #%03d:  Records - %d skipped by --sample\n", file_id, sampled_out);
+    if (skipped_bytes > 0)
+        printf("[ WRN ]: File #%03d:  %ld bytes of corrupt framing skipped\n", file_id, skipped_bytes);
+    head->header.num_records = num_records;
+    head->header.skipped_bytes = skipped_bytes;
+    head->header.event_counts = event_counts;
+    correlate_end(&sessions, "end_of_file");
+    free_pending_requests(&pending_requests);
+    head->header.sessions = sessions.rows;
+
+    return head;
+}
+
+/*
+ * parse_events runs as a pipeline of 3 stages: the prefetch thread opens and
+ * reads the files, --decoders threads run parse_file on them, and the calling
+ * thread writes the csv files. Decoded files go to the writer through a
+ * bounded lock-free queue, so decoders wait when the writer falls behind and
+ * at most PIPELINE_QUEUE_DEPTH parsed files are held per decoder.
+ *
+ * Unless --unordered is given the writer puts files back in input order with
+ * a reorder buffer of REORDER_WINDOW files; a decoder does not start a file
+ * more than REORDER_WINDOW files ahead of the last one written, so one slow
+ * file bounds how much is held instead of the whole run piling up behind it.
+ */
+#define PIPELINE_QUEUE_DEPTH 2
+#define REORDER_WINDOW 16
+#define MAX_DECODERS 256
+
+typedef struct DecodedFile
+{
+    int seq;         // input order, from 1
+    CTRStruct *head; // NULL when the file was skipped or quarantined
+} DecodedFile;
+
+typedef struct Pipeline
+{
+    Prefetcher pf;
+    Queue decoded; // DecodedFile *, pipeline_end once per decoder
+    atomic_int files_processed;
+    atomic_int written_seq; // every file up to this one is written
+} Pipeline;
+
+static DecodedFile pipeline_end_marker;
+#define pipeline_end (&pipeline_end_marker)
+
+void *decoder_worker(void *arg)
+{
+    Pipeline *pl = arg;
+    PrefetchItem input;
+    KpiMap partial = {0}, latency_partial = {0};
+    KpiMap file_kpis = {0}, file_latency = {0};
+
+    // counted per file, a quarantined or skipped file leaves no trace in the partials
+    if (kpis.count > 0)
+        kpi_counters = &file_kpis;
+    if (latency_pairs.count > 0)
+        latency_counters = &file_latency;
+
+    while (prefetch_next(&pl->pf, &input))
+    {
+        FILE *file;
+        char *fullpath = input.input.path;
+        file = input.error ? NULL : prefetch_fopen(&input);
+        atomic_fetch_add(&pl->files_processed, 1);
+
+        int spins = 0;
+        while (!unordered_flag && input.seq - atomic_load(&pl->written_seq) > REORDER_WINDOW)
+            queue_backoff(&spins);
+
+        DecodedFile *decoded = malloc(sizeof *decoded);
+        decoded->seq = input.seq;
+        if (file == NULL)
+        {
+            // like a file without a header record, the writer still gets its seq
+            quarantine_file(fullpath, 0, input.error ? strerror(input.error) : "could not be opened");
+            decoded->head = NULL;
+            prefetch_release(&pl->pf, &input);
+            queue_push(&pl->decoded, decoded);
+            continue;
+        }
+        decoded->head = parse_file(file, fullpath, input.input.file_name, input.seq);
+        if (kpis.count > 0)
+        {
+            if (decoded->head)
+                kpi_map_merge(&partial, &file_kpis);
+            kpi_map_reset(&file_kpis, decoded->head == NULL);
+        }
+        if (latency_pairs.count > 0)
+        {
+            if (decoded->head)
+                kpi_map_merge(&latency_partial, &file_latency);
+            kpi_map_reset(&file_latency, decoded->head == NULL);
+        }
+        prefetch_fclose(&input, file);
+        prefetch_release(&pl->pf, &input);
+
+        queue_push(&pl->decoded, decoded);
+    }
+
+    if (kpis.count > 0)
+    {
+        pthread_mutex_lock(&kpi_lock);
+        kpi_map_merge(&kpi_totals, &partial);
+        pthread_mutex_unlock(&kpi_lock);
+        free(partial.slots);
+        free(file_kpis.slots);
+    }
+    if (latency_pairs.count > 0)
+    {
+        pthread_mutex_lock(&kpi_lock);
+        kpi_map_merge(&latency_totals, &latency_partial);
+        pthread_mutex_unlock(&kpi_lock);
+        free(latency_partial.slots);
+        free(file_latency.slots);
+    }
+
+    queue_push(&pl->decoded, pipeline_end);
+    return NULL;
 }
 
-void print_event(CTRStruct *ptr)
+void write_parsed_file(CTRStruct *head, int *files_written)
 {
-    printf("\nEvent (%d bytes):\n", ptr->event.length);
-    printf("{\n");
-    printf("file-id: %d\n", ptr->file_id);
-    if (ptr->event.name)
+    if (head == NULL)
+        return;
+
+    if (list_records_flag == true)
     {
-        printf("Event: %s (%d)\n", ptr->event.name, ptr->event.id);
+        list_records(head);
+    }
+
+    char *mode = ((*files_written)++ == 0) ? "w" : "a";
+
+    char files_parsed_filename[500] = {0};
+    sprintf(files_parsed_filename, files_filename_format, output_dir);
+    print_files_csv(head, files_parsed_filename, mode);
+
+    if (aggregate_flag)
+    {
+        merge_event_counts(&head->header);
     }
     else
     {
-        printf("Event: %d\n", ptr->event.id);
+        char reports_filepath[500] = {0};
+        char date[9], rop[5];
+        sprintf(reports_filepath, records_filename_format, output_dir, head->header.ne_logical_label,
+                format_date(date, &head->header.date_time), format_rop(rop, &head->header.date_time));
+        if (!merge_flag)
+            print_records_csv(head, reports_filepath, mode);
+
+        if (event_columns_arg)
+            print_events_csv(head, mode);
     }
-    printf("Event parameters: ");
 
-    for (int i = 0; i <= ptr->event.length - 4 - 3; i = i + 2)
+    if (session_key_arg)
     {
-        printf("%02x%02x ", ptr->event.parameters[i], ptr->event.parameters[i + 1]);
+        print_sessions_csv(head, mode);
+        free_session_rows(&head->header.sessions);
     }
-    printf("}\n");
-}
 
-void print_footer(CTRStruct *ptr)
-{
-    printf("\nFooter (%d bytes):\n", ptr->footer.length);
-    printf("{\n");
-    printf("timestamp: %s\n", ptr->footer.date_time);
-    printf("file-id: %d\n", ptr->file_id);
-    printf("Padding Bytes: 0x%02x\n", ptr->scanner.padding[0]);
-    printf("}\n");
+    if (dump_records_flag == true)
+        dump_records(head);
+
+    if (timeline_flag)
+        timeline_add_file(head);
+
+    if (merge_flag && !aggregate_flag)
+        merge_add_file(head);
+
+    free_events(head);
 }
 
-int dump_records(CTRStruct *node)
+/* writer stage, returns the number of files written */
+int write_parsed_files(Pipeline *pl, int decoders)
 {
-    if (node == NULL)
-        return EXIT_SUCCESS;
-    do
+    DecodedFile *pending[REORDER_WINDOW] = {0}; // by seq % REORDER_WINDOW
+    int next_seq = 1;
+    int files_written = 0;
+
+    while (decoders > 0)
     {
-        switch (node->type)
+        DecodedFile *decoded = queue_pop(&pl->decoded);
+        if (decoded == pipeline_end)
         {
-        case HEADER:
-            print_header(node);
-            break;
-        case SCANNER:
-            print_scanner(node);
-            break;
-        case EVENT:
-            print_event(node);
-            break;
-        case FOOTER:
-            print_footer(node);
-            break;
+            decoders--;
+            continue;
         }
-    } while ((node = node->next) != NULL);
 
-    return EXIT_SUCCESS;
+        if (unordered_flag)
+        {
+            write_parsed_file(decoded->head, &files_written);
+            free(decoded);
+            continue;
+        }
+
+        pending[decoded->seq % REORDER_WINDOW] = decoded;
+        while ((decoded = pending[next_seq % REORDER_WINDOW]) != NULL && decoded->seq == next_seq)
+        {
+            pending[next_seq % REORDER_WINDOW] = NULL;
+            write_parsed_file(decoded->head, &files_written);
+            free(decoded);
+            atomic_store(&pl->written_seq, next_seq++);
+        }
+    }
+    return files_written;
 }
 
-int list_records(CTRStruct *node)
+int parse_events()
 {
-    if (node == NULL)
-        return EXIT_SUCCESS;
-    printf("\nRecords:\n");
+    FileSource src;
+    Pipeline pl;
+    int decoders = decoder_threads > 0 ? decoder_threads : 1;
+    pthread_t threads[decoders];
+
+    if (!file_source_open(&src))
+        exit(EXIT_FAILURE);
+    prefetch_start(&pl.pf, &src, (io_uring_flag && prefetch_depth <= 0) ? URING_BATCH : prefetch_depth);
+    queue_init(&pl.decoded, PIPELINE_QUEUE_DEPTH * decoders);
+    atomic_init(&pl.files_processed, 0);
+    atomic_init(&pl.written_seq, 0);
+
+    printf("\nParsing:\n");
     printf("------------------------------------------------------------------------\n");
-    printf("%3s %3s %6s %5s           %9s\n", "File_Id", "Id", "Bytes", "Type", "Event(Id)");
 
-    do
+    for (int i = 0; i < decoders; i++)
+        pthread_create(&threads[i], NULL, decoder_worker, &pl);
+
+    int files_written = write_parsed_files(&pl, decoders);
+
+    for (int i = 0; i < decoders; i++)
+        pthread_join(threads[i], NULL);
+    queue_free(&pl.decoded);
+    prefetch_stop(&pl.pf);
+    file_source_close(&src);
+    printf("[ INF ]: %d files parsed\n", atomic_load(&pl.files_processed));
+
+    if (files_quarantined > 0)
+        printf("[ WRN ]: %d files quarantined\n", files_quarantined);
+
+    if (aggregate_flag)
+        print_aggregate_csv();
+
+    if (kpis.count > 0)
+        print_kpi_csv();
+
+    if (latency_pairs.count > 0)
+        print_latency_csv();
+
+    if (merge_sites != NULL)
+        print_merged_sites();
+
+    if (timeline_flag)
+        print_timeline_csv();
+
+    return files_written;
+}
+
+typedef struct InventoryEntry
+{
+    char *path;
+    const char *file_name;
+    long size;
+    const char *status;
+    CTRStruct header;
+    CTRStruct footer;
+    bool has_header;
+    bool has_footer;
+} InventoryEntry;
+
+typedef struct InventoryJob
+{
+    InventoryEntry *entries;
+    int n_entries;
+    atomic_int next;
+} InventoryJob;
+
+#define INVENTORY_TAIL 64 // the footer is searched in the last bytes of the file
+
+/* Read the HEADER at the start of the file and the FOOTER that ends it, without
+ * walking the records in between. */
+void inventory_file(InventoryEntry *entry)
+{
+    uint8_t buf[UINT16_MAX];
+    struct stat st;
+
+    entry->status = "ok";
+
+    int fd = open(entry->path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
     {
-        switch (node->type)
+        entry->status = "open failed";
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    entry->size = st.st_size;
+
+    uint16_t hdr_len = record_min_length(HEADER);
+    if (pread(fd, buf, hdr_len, 0) != hdr_len ||
+        !record_plausible(be16_to_cpu(buf), be16_to_cpu(buf + 2), entry->size, true))
+    {
+        entry->status = "no header record";
+        close(fd);
+        return;
+    }
+    read_header(&entry->header, be16_to_cpu(buf), buf + 4);
+    entry->has_header = true;
+    strcpy((char *)entry->header.header.file_name, entry->file_name);
+
+    long tail = entry->size < INVENTORY_TAIL ? entry->size : INVENTORY_TAIL;
+    if (pread(fd, buf, tail, entry->size - tail) == tail)
+    {
+        for (long i = tail - record_min_length(FOOTER); i >= 0; i--)
         {
-        case HEADER:
-            printf("%6d  %3d  %5d  %-7s\n", node->file_id, node->record_id, node->header.length, "HEADER");
-            break;
-        case SCANNER:
-            printf("%6d  %3d  %5d  %-7s\n", node->file_id, node->record_id, node->header.length, "SCANNER");
-            break;
-        case EVENT:
-            printf("%6d  %3d  %5d  %-7s   %s (%d)\n", node->file_id, node->record_id, node->header.length, "EVENT", node->event.name, node->event.id);
-            break;
-        case FOOTER:
-            printf("%6d  %3d  %5d  %-7s\n", node->file_id, node->record_id, node->header.length, "FOOTER");
-            break;
+            if (be16_to_cpu(buf + i + 2) == FOOTER && be16_to_cpu(buf + i) == tail - i)
+            {
+                read_footer(&entry->footer, tail - i, buf + i + 4);
+                entry->has_footer = true;
+                break;
+            }
         }
-    } while ((node = node->next) != NULL);
+    }
+    if (!entry->has_footer)
+        entry->status = "no footer record";
+    if (!header_selected(&entry->header.header))
+        entry->status = "not selected";
 
-    return EXIT_SUCCESS;
+    close(fd);
 }
 
-int print_records_csv(CTRStruct *node, const char *path, char *mode)
+void *inventory_worker(void *arg)
+{
+    InventoryJob *job = arg;
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->n_entries)
+        inventory_file(&job->entries[i]);
+    return NULL;
+}
+
+/* a csv field in quotes, quotes inside doubled; file and node names hold commas */
+void print_csv_quoted(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s != '\0'; s++)
+    {
+        if (*s == '"')
+            fputc('"', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+int print_inventory_csv(InventoryEntry *entries, int n_entries, const char *path)
 {
     bool result = true;
 
-    FILE *f = fopen(path, mode);
+    FILE *f = fopen(path, "w");
     if (f == NULL)
     {
         printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
         nob_return_defer(false);
     }
 
-    if (node == NULL)
-        nob_return_defer(false);
-
-    if (strcmp(mode, "w") == 0)
-        fprintf(f, "File_Id,Event_Name,Event_Size_bytes,Event_Id,Event_name\n");
-
-    do
+    fprintf(f, "filename,size_bytes,status,ne_user_label,ne_logical_label,date,rop,file_version,pm_version,pm_revision,header_datetime,footer_datetime\n");
+    for (int i = 0; i < n_entries; i++)
     {
-        switch (node->type)
+        InventoryEntry *entry = &entries[i];
+        CTRHeader *header = &entry->header.header;
+        if (strcmp(entry->status, "not selected") == 0)
+            continue;
+        char date[9] = {0}, rop[5] = {0}, header_date_time[20] = {0}, footer_date_time[20] = {0};
+
+        if (entry->has_header)
         {
-        case HEADER:
-            fprintf(f, "%d,%s,%d\n", node->file_id, "HEADER", node->header.length);
-            break;
-        case SCANNER:
-            fprintf(f, "%d,%s,%d\n", node->file_id, "SCANNER", node->scanner.length);
-            break;
-        case EVENT:
-            fprintf(f, "%d,%s,%d,%d,%s\n", node->file_id, "EVENT", node->event.length, node->event.id, node->event.name);
-            break;
-        case FOOTER:
-            fprintf(f, "%d,%s,%d\n", node->file_id, "FOOTER", node->footer.length);
-            break;
+            format_date(date, &header->date_time);
+            format_rop(rop, &header->date_time);
+            format_date_time(header_date_time, &header->date_time);
         }
-    } while ((node = node->next) != NULL);
+        if (entry->has_footer)
+            format_date_time(footer_date_time, &entry->footer.footer.date_time);
+
+        print_csv_quoted(f, entry->file_name);
+        fprintf(f, ",%ld,%s,", entry->size, entry->status);
+        print_csv_quoted(f, (const char *)header->ne_user_label);
+        fputc(',', f);
+        print_csv_quoted(f, (const char *)header->ne_logical_label);
+        fprintf(f, ",%s,%s,%s,%s,%s,%s,%s\n", date, rop,
+                header->file_version, header->pm_version, header->pm_revision, header_date_time, footer_date_time);
+    }
 
 defer:
     if (f)
@@ -762,24 +5645,349 @@ defer:
     return result;
 }
 
-int print_files_csv(CTRStruct *node, const char *path, char *mode)
+int get_num_threads()
+{
+    if (num_threads > 0)
+        return num_threads;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+/* --inventory: header and footer of every input file to ctr_inventory.csv */
+int inventory_files()
+{
+    FileSource src;
+    InputFile input;
+    InputFiles files = {0};
+
+    if (!file_source_open(&src))
+        exit(EXIT_FAILURE);
+    while (file_source_next(&src, &input))
+        nob_da_append(&files, input);
+    file_source_close(&src);
+    int n_files = files.count;
+
+    InventoryJob job = {0};
+    job.entries = calloc(n_files > 0 ? n_files : 1, sizeof(InventoryEntry));
+    job.n_entries = n_files;
+    for (int i = 0; i < n_files; i++)
+    {
+        job.entries[i].file_name = files.items[i].file_name;
+        job.entries[i].path = files.items[i].path;
+    }
+
+    int threads = get_num_threads();
+    if (threads > n_files)
+        threads = n_files > 0 ? n_files : 1;
+
+    printf("\nInventory: (%d files, %d threads)\n", n_files, threads);
+    printf("------------------------------------------------------------------------\n");
+
+    pthread_t workers[threads];
+    for (int i = 0; i < threads; i++)
+        pthread_create(&workers[i], NULL, inventory_worker, &job);
+    for (int i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+
+    int incomplete = 0;
+    for (int i = 0; i < n_files; i++)
+    {
+        if (strcmp(job.entries[i].status, "ok") != 0 && strcmp(job.entries[i].status, "not selected") != 0)
+        {
+            printf("[ WRN ]: %s: %s\n", job.entries[i].path, job.entries[i].status);
+            incomplete++;
+        }
+    }
+
+    char inventory_filename[500] = {0};
+    sprintf(inventory_filename, inventory_filename_format, output_dir);
+    bool result = print_inventory_csv(job.entries, n_files, inventory_filename);
+    printf("[ INF ]: Inventory of %d files (%d incomplete) written to %s\n", n_files, incomplete, inventory_filename);
+
+    for (int i = 0; i < n_files; i++)
+        free(job.entries[i].path);
+    free(job.entries);
+    nob_da_free(files);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * --rollup: merge rop level outputs of earlier runs (ctr_aggregate.csv and,
+ * with --kpi-bin, ctr_kpi_sketches.csv) into stores in the output directory,
+ * each kept at rop, hourly and daily level. Every rop found in the inputs
+ * replaces what the store held for it, so a rop run again after a late file
+ * does not count twice, and only the hours and days of those rops are
+ * recomputed from the rop level. Sketches merge like in the decoders: HLL
+ * registers by max, top summaries by adding the counts.
+ *
+ * KPI sketches are counted over all sites of a run and carry no site, so a
+ * rop of ctr_kpi_sketches.csv replaces that KPI's rop for every site: run a
+ * rop again with the files of all sites, not only the late one.
+ */
+enum RollupLevel
+{
+    ROLLUP_ROP,
+    ROLLUP_HOURLY,
+    ROLLUP_DAILY,
+    ROLLUP_LEVELS,
+};
+
+const char *rollup_level_names[ROLLUP_LEVELS] = {"rop", "hourly", "daily"};
+
+typedef struct RollupRow
+{
+    char key[512]; // csv columns of the bucket, written as they are
+    uint64_t events;
+    uint64_t bytes;
+    enum KpiKind kind; // sketch rows
+    void *sketch;
+    UT_hash_handle hh;
+} RollupRow;
+
+typedef struct RollupStore
+{
+    const char *name;
+    const char *input;           // file the rop level rows come from
+    int rop_col;                 // key column holding the rop, hour in the hourly store, none in the daily
+    int key_cols;                // at rop level
+    bool sketches;
+    const char *headers[ROLLUP_LEVELS];
+    RollupRow *rows[ROLLUP_LEVELS];
+    RollupRow *fresh; // rows read from the inputs
+} RollupStore;
+
+RollupStore rollup_stores[] = {
+    {
+        .name = "aggregate",
+        .input = "ctr_aggregate.csv",
+        .rop_col = 2,
+        .key_cols = 5,
+        .headers = {
+            "ne_logical_label,date,rop,event_id,event_name,events,bytes",
+            "ne_logical_label,date,hour,event_id,event_name,events,bytes",
+            "ne_logical_label,date,event_id,event_name,events,bytes",
+        },
+    },
+    {
+        .name = "sketches",
+        .input = "ctr_kpi_sketches.csv",
+        .rop_col = 3,
+        .key_cols = 5,
+        .sketches = true,
+        .headers = {
+            "kpi,kind,date,rop,group,events,estimate,state",
+            "kpi,kind,date,hour,group,events,estimate,state",
+            "kpi,kind,date,group,events,estimate,state",
+        },
+    },
+};
+
+#define ROLLUP_STORES (sizeof rollup_stores / sizeof rollup_stores[0])
+
+/* the ',' or '\0' after the field starting at p, commas inside "quotes" are part of the field */
+const char *csv_field_end(const char *p)
+{
+    bool quoted = false;
+    for (; *p != '\0'; p++)
+    {
+        if (*p == '"')
+            quoted = !quoted; // "" inside quotes toggles twice
+        else if (*p == ',' && !quoted)
+            break;
+    }
+    return p;
+}
+
+/* length of the first n columns of a csv line, -1 when it has fewer */
+int csv_prefix(const char *line, int n)
+{
+    const char *p = line;
+    for (int col = 1; col < n; col++)
+    {
+        p = csv_field_end(p);
+        if (*p == '\0')
+            return -1;
+        p++;
+    }
+    return csv_field_end(p) - line;
+}
+
+/* the key with the rop column cut to width characters (hh), or dropped when width is 0 */
+void rollup_bucket(char *out, const char *key, int rop_col, int width)
+{
+    const char *p = key;
+    bool first = true;
+    for (int col = 0;; col++)
+    {
+        const char *end = csv_field_end(p);
+        int n = end - p;
+        if (col == rop_col && n > width)
+            n = width;
+        if (col != rop_col || width > 0)
+        {
+            if (!first)
+                *out++ = ',';
+            memcpy(out, p, n);
+            out += n;
+            first = false;
+        }
+        if (*end == '\0')
+            break;
+        p = end + 1;
+    }
+    *out = '\0';
+}
+
+/* add a row to a table, the sketch is taken over */
+void rollup_add(RollupRow **rows, const char *key, uint64_t events, uint64_t bytes, enum KpiKind kind, void *sketch)
+{
+    RollupRow *row;
+
+    HASH_FIND_STR(*rows, key, row);
+    if (row == NULL)
+    {
+        row = calloc(1, sizeof *row);
+        strcpy(row->key, key);
+        row->kind = kind;
+        HASH_ADD_STR(*rows, key, row);
+    }
+    row->events += events;
+    row->bytes += bytes;
+    if (sketch == NULL)
+        return;
+    if (row->sketch == NULL)
+    {
+        row->sketch = sketch;
+        return;
+    }
+    if (kind == KPI_DISTINCT)
+        hll_merge(row->sketch, sketch);
+    else
+        topk_merge(row->sketch, sketch);
+    free_sketch(kind, sketch);
+}
+
+void rollup_delete(RollupRow **rows, RollupRow *row)
+{
+    HASH_DEL(*rows, row);
+    free_sketch(row->kind, row->sketch);
+    free(row);
+}
+
+void rollup_free(RollupRow **rows)
+{
+    RollupRow *row, *tmp;
+    HASH_ITER(hh, *rows, row, tmp)
+    {
+        rollup_delete(rows, row);
+    }
+}
+
+bool rollup_contains(RollupRow *set, const char *key)
+{
+    RollupRow *row;
+    HASH_FIND_STR(set, key, row);
+    return row != NULL;
+}
+
+/* read a store level or an input (no estimate column) into rows; false when the file can not be read */
+bool rollup_load(RollupStore *store, RollupRow **rows, const char *path, int key_cols, bool input)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int line_no = 0, skipped = 0;
+    while ((len = getline(&line, &size, f)) != -1)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line_no++ == 0)
+            continue; // header
+
+        char key[512];
+        int n = csv_prefix(line, key_cols);
+        if (n < 0 || n >= (int)sizeof key || line[n] != ',')
+        {
+            skipped++;
+            continue;
+        }
+        memcpy(key, line, n);
+        key[n] = '\0';
+
+        unsigned long long events = 0, bytes = 0;
+        const char *values = line + n + 1;
+        if (!store->sketches)
+        {
+            if (sscanf(values, "%llu,%llu", &events, &bytes) != 2)
+                skipped++;
+            else
+                rollup_add(rows, key, events, bytes, KPI_COUNT, NULL);
+            continue;
+        }
+
+        // kind is the second key column; rows of runs without --kpi-bin have no rop and can not be placed
+        enum KpiKind kind = strncmp(strchr(key, ',') + 1, "hll,", 4) == 0 ? KPI_DISTINCT : KPI_TOP;
+        char bucket[512];
+        rollup_bucket(bucket, key, store->rop_col, 0);
+        const char *state = strchr(values, ',');
+        if (state && !input)
+            state = strchr(state + 1, ','); // estimate
+        void *sketch = state ? parse_sketch_state(kind, state + 1) : NULL;
+        if (sscanf(values, "%llu", &events) != 1 || sketch == NULL || csv_prefix(key, store->rop_col + 1) == csv_prefix(key, store->rop_col) + 1)
+        {
+            free_sketch(kind, sketch);
+            skipped++;
+            continue;
+        }
+        rollup_add(rows, key, events, 0, kind, sketch);
+    }
+
+    if (skipped > 0)
+        printf("[ WRN ]: %d rows of %s skipped, not in the expected format or without a rop\n", skipped, path);
+    free(line);
+    fclose(f);
+    return true;
+}
+
+int compare_rollup_rows(RollupRow *a, RollupRow *b)
+{
+    return strcmp(a->key, b->key);
+}
+
+int print_rollup_csv(RollupStore *store, enum RollupLevel level)
 {
     bool result = true;
+    char path[500] = {0};
+    sprintf(path, rollup_filename_format, output_dir, store->name, rollup_level_names[level]);
 
-    FILE *f = fopen(path, mode);
+    FILE *f = fopen(path, "w");
     if (f == NULL)
     {
         printf("[ ERR ]: Could not open file %s for writing: %s\n", path, strerror(errno));
         nob_return_defer(false);
     }
 
-    if (node == NULL)
-        nob_return_defer(false);
-
-    if (strcmp(mode, "w") == 0)
-        fprintf(f, "id, records, parse_datetime, filename\n");
-
-    fprintf(f, "%d,%u,%s,%s\n", node->file_id, (unsigned int)node->header.num_records, node->header.parse_timestamp, node->header.file_name);
+    HASH_SORT(store->rows[level], compare_rollup_rows);
+    fprintf(f, "%s\n", store->headers[level]);
+    for (RollupRow *row = store->rows[level]; row != NULL; row = row->hh.next)
+    {
+        if (!store->sketches)
+        {
+            fprintf(f, "%s,%llu,%llu\n", row->key, (unsigned long long)row->events, (unsigned long long)row->bytes);
+            continue;
+        }
+        fprintf(f, "%s,%llu,", row->key, (unsigned long long)row->events);
+        if (row->kind == KPI_DISTINCT)
+            fprintf(f, "%llu", (unsigned long long)hll_estimate(row->sketch));
+        fprintf(f, ",");
+        print_sketch_state(f, row->kind, row->sketch);
+        fprintf(f, "\n");
+    }
 
 defer:
     if (f)
@@ -787,109 +5995,143 @@ defer:
     return result;
 }
 
-CTRStruct *parse_events()
+/* replace the rops of the fresh rows and recompute their hours and days */
+void rollup_store(RollupStore *store)
 {
-    CTRStruct *head = NULL;
-    CTRStruct *node = NULL;
-    CTRStruct *tail = NULL;
-
-    struct dirent **fileList;
-
-    int n_files = scandir(input_dir, &fileList, parse_ext_bin, alphasort);
-    if (n_files == -1)
-    {
-        perror("[ DBG ]");
-        exit(EXIT_FAILURE);
-    }
-    else
-    {
-        printf("\nParsing: (%d files)\n", n_files);
-        printf("------------------------------------------------------------------------\n");
-    }
+    RollupRow *rops = NULL, *hours = NULL, *days = NULL;
+    RollupRow *row, *tmp;
+    char unit[512], bucket[512];
 
-    int files_processed = 0;
-    while (n_files--)
+    HASH_ITER(hh, store->fresh, row, tmp)
     {
-        FILE *file;
-        char *fullpath = malloc(strlen(input_dir) + strlen(fileList[n_files]->d_name) + 2); // + 2 because of the '/' and the terminating 0
-        sprintf(fullpath, "%s/%s", input_dir, fileList[n_files]->d_name);
-        file = fopen(fullpath, "rb");
-        if (file == NULL)
+        memcpy(unit, row->key, csv_prefix(row->key, store->rop_col + 1));
+        unit[csv_prefix(row->key, store->rop_col + 1)] = '\0';
+        if (!rollup_contains(rops, unit))
         {
-            printf("[ ERR ]: Opening the file %s\n", fullpath);
-            exit(EXIT_FAILURE);
+            rollup_add(&rops, unit, 0, 0, KPI_COUNT, NULL);
+            rollup_bucket(bucket, unit, store->rop_col, 2);
+            rollup_add(&hours, bucket, 0, 0, KPI_COUNT, NULL);
+            rollup_bucket(bucket, unit, store->rop_col, 0);
+            rollup_add(&days, bucket, 0, 0, KPI_COUNT, NULL);
         }
-        files_processed++;
+    }
 
-        int file_lenght = get_file_lenght(file);
-        if (file_lenght > 0)
-        {
-            printf("[ INF ]: File #%03d:  %s\n", files_processed, fullpath);
-            printf("[ INF ]: File #%03d:  Size - %s\n", files_processed, calculateSize(file_lenght));
-        }
-        else
+    // drop what the store had for those buckets
+    RollupRow *affected[ROLLUP_LEVELS] = {rops, hours, days};
+    for (int level = ROLLUP_ROP; level < ROLLUP_LEVELS; level++)
+    {
+        int unit_cols = level == ROLLUP_DAILY ? store->rop_col : store->rop_col + 1;
+        HASH_ITER(hh, store->rows[level], row, tmp)
         {
-            printf("[ ERR ]: File is empty");
+            int n = csv_prefix(row->key, unit_cols);
+            memcpy(unit, row->key, n);
+            unit[n] = '\0';
+            if (rollup_contains(affected[level], unit))
+                rollup_delete(&store->rows[level], row);
         }
+    }
 
-        head = NULL;
-        node = NULL;
-        tail = NULL;
-        int num_records = 0;
-        while (file_lenght > 0 && num_records < max_records)
-        {
+    HASH_ITER(hh, store->fresh, row, tmp)
+    {
+        rollup_add(&store->rows[ROLLUP_ROP], row->key, row->events, row->bytes, row->kind, row->sketch);
+        row->sketch = NULL;
+        rollup_delete(&store->fresh, row);
+    }
 
-            uint16_t record_lenght = 0;
-            uint16_t record_type = 255;
-            read_record_len_type(&record_lenght, &record_type, file);
-            num_records++;
+    // and build them again from the rop level, a day also takes the rops of its untouched hours
+    for (row = store->rows[ROLLUP_ROP]; row != NULL; row = row->hh.next)
+    {
+        rollup_bucket(bucket, row->key, store->rop_col, 2);
+        int n = csv_prefix(bucket, store->rop_col + 1);
+        memcpy(unit, bucket, n);
+        unit[n] = '\0';
+        if (rollup_contains(hours, unit))
+            rollup_add(&store->rows[ROLLUP_HOURLY], bucket, row->events, row->bytes, row->kind,
+                       row->sketch ? clone_sketch(row->kind, row->sketch) : NULL);
+
+        n = csv_prefix(row->key, store->rop_col);
+        memcpy(unit, row->key, n);
+        unit[n] = '\0';
+        if (!rollup_contains(days, unit))
+            continue;
+        rollup_bucket(bucket, row->key, store->rop_col, 0);
+        rollup_add(&store->rows[ROLLUP_DAILY], bucket, row->events, row->bytes, row->kind,
+                   row->sketch ? clone_sketch(row->kind, row->sketch) : NULL);
+    }
 
-            node = add_record(num_records, record_type, record_lenght, file, files_processed);
+    printf("[ INF ]: %s: %u rops replaced, %u hours and %u days recomputed\n", store->name,
+           HASH_COUNT(rops), HASH_COUNT(hours), HASH_COUNT(days));
+    rollup_free(&rops);
+    rollup_free(&hours);
+    rollup_free(&days);
+}
 
-            if (record_type == HEADER)
-            {
-                head = tail = node;
-                strcpy((char *)node->header.file_name, fileList[n_files]->d_name);
-            }
-            else
-            {
-                tail->next = node;
-                tail = node;
-            }
+/* an input is a rop level csv or a directory holding them */
+int rollup_input(const char *path)
+{
+    int loaded = 0;
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        printf("[ ERR ]: Could not read %s: %s\n", path, strerror(errno));
+        return 0;
+    }
 
-            file_lenght = file_lenght - record_lenght;
-        }
-        printf("[ INF ]: File #%03d:  Records - %d processed\n", files_processed, num_records);
-        head->header.num_records = num_records;
+    for (size_t i = 0; i < ROLLUP_STORES; i++)
+    {
+        RollupStore *store = &rollup_stores[i];
+        char file[500] = {0};
+        if (S_ISDIR(st.st_mode))
+            snprintf(file, sizeof file, "%s/%s", path, store->input);
+        else if (strcmp(strrchr(path, '/') ? strrchr(path, '/') + 1 : path, store->input) == 0)
+            snprintf(file, sizeof file, "%s", path);
+        else
+            continue;
 
-        if (list_records_flag == true)
+        if (rollup_load(store, &store->fresh, file, store->key_cols, true))
         {
-            list_records(head);
+            printf("[ INF ]: %s read\n", file);
+            loaded++;
         }
+    }
+    if (loaded == 0)
+        printf("[ WRN ]: no %s or %s in %s\n", rollup_stores[0].input, rollup_stores[1].input, path);
+    return loaded;
+}
 
-        char *mode = (files_processed == 1) ? "w" : "a";
-
-        char files_parsed_filename[500] = {0};
-        sprintf(files_parsed_filename, files_filename_format, output_dir);
-        print_files_csv(head, files_parsed_filename, mode);
-
-        char reports_filepath[500] = {0};
-        sprintf(reports_filepath, records_filename_format, output_dir, head->header.ne_logical_label, head->header.date, head->header.rop);
-        print_records_csv(head, reports_filepath, mode);
-
-        if (dump_records_flag == true)
-            dump_records(head);
+int rollup()
+{
+    int loaded = 0;
 
-        free(fullpath);
-        free(fileList[n_files]);
-        fclose(file);
+    printf("\nRollup:\n");
+    printf("------------------------------------------------------------------------\n");
 
-        // free_events(head);
+    for (size_t i = 0; i < ROLLUP_STORES; i++)
+    {
+        RollupStore *store = &rollup_stores[i];
+        for (int level = ROLLUP_ROP; level < ROLLUP_LEVELS; level++)
+        {
+            char path[500] = {0};
+            sprintf(path, rollup_filename_format, output_dir, store->name, rollup_level_names[level]);
+            rollup_load(store, &store->rows[level], path, level == ROLLUP_DAILY ? store->key_cols - 1 : store->key_cols, false);
+        }
     }
 
-    free(fileList);
+    for (size_t i = 0; i < input_paths.count; i++)
+        loaded += rollup_input(input_paths.items[i]);
+    if (loaded == 0)
+        return EXIT_FAILURE;
 
-    return head;
+    for (size_t i = 0; i < ROLLUP_STORES; i++)
+    {
+        RollupStore *store = &rollup_stores[i];
+        if (store->fresh == NULL)
+            continue;
+        rollup_store(store);
+        for (int level = ROLLUP_ROP; level < ROLLUP_LEVELS; level++)
+            print_rollup_csv(store, level);
+    }
+    return EXIT_SUCCESS;
 }
 
 EventConfig *load_event_config(const char *path)
@@ -941,7 +6183,7 @@ EventConfig *load_event_config(const char *path)
 
         // read event param fields and add it to the list
         const char *param_name = nob_temp_sv_to_cstr(nob_sv_trim(nob_sv_chop_by_delim(&line, ' ')));
-        bool param_unavailable_flag = (nob_temp_sv_to_cstr(nob_sv_trim(nob_sv_chop_by_delim(&line, ' ')))[0] == 'N') ? false : false;
+        bool param_unavailable_flag = (nob_temp_sv_to_cstr(nob_sv_trim(nob_sv_chop_by_delim(&line, ' ')))[0] == 'N') ? false : true;
         const char *param_type = nob_temp_sv_to_cstr(nob_sv_trim(nob_sv_chop_by_delim(&line, ' ')));
         int param_size = nob_temp_sv_to_int(nob_sv_trim(nob_sv_chop_by_delim(&line, ' ')));
 
@@ -975,6 +6217,12 @@ EventConfig *load_event_config(const char *path)
     }
     printf("[ CFG ]: Total %d event params added to config table\n", row);
 
+    EventConfig *event, *tmp;
+    HASH_ITER(hh, event_hash, event, tmp)
+    {
+        layout_pm_event_params(event);
+    }
+
     // event_param = find_pm_event_param_by_name(tail, "EVENT_PARAM_L3MESSAGE_CONTENTS");
     // printf("param name = %s\n", event_param->name);
     // free_pm_events(head);
@@ -1034,6 +6282,290 @@ int parse_args(int argc, char **argv)
             verbose_flag = true;
             printf("[ CFG ]: Verbose flag on\n");
         }
+        else if (strcmp(flag, "-e") == 0 || strcmp(flag, "--events") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            else
+            {
+                event_filter_arg = shift_args(&argc, &argv);
+                printf("[ CFG ]: Set event filter to '%s'\n", event_filter_arg);
+            }
+        }
+        else if (strcmp(flag, "-w") == 0 || strcmp(flag, "--where") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            else
+            {
+                event_predicate_arg = shift_args(&argc, &argv);
+                printf("[ CFG ]: Set event filter expression to '%s'\n", event_predicate_arg);
+            }
+        }
+        else if (strcmp(flag, "--columns") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            else
+            {
+                event_columns_arg = shift_args(&argc, &argv);
+                printf("[ CFG ]: Set event columns to '%s'\n", event_columns_arg);
+            }
+        }
+        else if (strcmp(flag, "--blobs") == 0)
+        {
+            blob_store_flag = true;
+            printf("[ CFG ]: Blob store flag on\n");
+        }
+        else if (strcmp(flag, "--on-error") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            const char *value = shift_args(&argc, &argv);
+            if (strcmp(value, "resync") == 0)
+                on_error = ON_ERROR_RESYNC;
+            else if (strcmp(value, "quarantine") == 0)
+                on_error = ON_ERROR_QUARANTINE;
+            else
+            {
+                fprintf(stderr, "[ ERR ]: unknown value '%s' for %s\n", value, flag);
+                exit(EXIT_FAILURE);
+            }
+            printf("[ CFG ]: Set bad framing handling to '%s'\n", value);
+        }
+        else if (strcmp(flag, "--rollup") == 0)
+        {
+            rollup_flag = true;
+            printf("[ CFG ]: Rollup flag on\n");
+        }
+        else if (strcmp(flag, "--inventory") == 0)
+        {
+            inventory_flag = true;
+            printf("[ CFG ]: Inventory flag on\n");
+        }
+        else if (strcmp(flag, "--decoders") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            decoder_threads = atoi(shift_args(&argc, &argv));
+            if (decoder_threads <= 0 || decoder_threads > MAX_DECODERS)
+            {
+                fprintf(stderr, "[ ERR ]: --decoders must be between 1 and %d threads\n", MAX_DECODERS);
+                exit(EXIT_FAILURE);
+            }
+            printf("[ CFG ]: Decoder threads set to %d\n", decoder_threads);
+        }
+        else if (strcmp(flag, "--kpi") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            kpi_definitions_arg = shift_args(&argc, &argv);
+            printf("[ CFG ]: KPI definitions file set to %s\n", kpi_definitions_arg);
+        }
+        else if (strcmp(flag, "--latency") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            latency_definitions_arg = shift_args(&argc, &argv);
+            printf("[ CFG ]: Latency definitions file set to %s\n", latency_definitions_arg);
+        }
+        else if (strcmp(flag, "--sessions") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            session_key_arg = shift_args(&argc, &argv);
+            printf("[ CFG ]: Session correlation on %s\n", session_key_arg);
+        }
+        else if (strcmp(flag, "--sample") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            sample_rate = atoi(shift_args(&argc, &argv));
+            if (sample_rate <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: --sample must be a positive number of UEs\n");
+                exit(EXIT_FAILURE);
+            }
+            printf("[ CFG ]: Sample set to 1 in %d UEs\n", sample_rate);
+        }
+        else if (strcmp(flag, "--sample-param") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            sample_param_arg = shift_args(&argc, &argv);
+            printf("[ CFG ]: Sample param set to %s\n", sample_param_arg);
+        }
+        else if (strcmp(flag, "--session-timeout") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            int timeout = atoi(shift_args(&argc, &argv));
+            if (timeout <= 0 || timeout > 24 * 60 * 60)
+            {
+                fprintf(stderr, "[ ERR ]: --session-timeout must be between 1 and %d seconds\n", 24 * 60 * 60);
+                exit(EXIT_FAILURE);
+            }
+            session_timeout_ms = timeout * 1000;
+            printf("[ CFG ]: Session timeout set to %d seconds\n", session_timeout_ms / 1000);
+        }
+        else if (strcmp(flag, "--kpi-bin") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            kpi_bin_seconds = atoi(shift_args(&argc, &argv));
+            if (kpi_bin_seconds <= 0 || kpi_bin_seconds > 24 * 60 * 60)
+            {
+                fprintf(stderr, "[ ERR ]: --kpi-bin must be between 1 and %d seconds\n", 24 * 60 * 60);
+                exit(EXIT_FAILURE);
+            }
+            printf("[ CFG ]: KPI time bin set to %d seconds\n", kpi_bin_seconds);
+        }
+        else if (strcmp(flag, "--aggregate") == 0)
+        {
+            aggregate_flag = true;
+            printf("[ CFG ]: Aggregate flag on\n");
+        }
+        else if (strcmp(flag, "--merge") == 0)
+        {
+            merge_flag = true;
+            printf("[ CFG ]: Merge flag on\n");
+        }
+        else if (strcmp(flag, "--timeline") == 0)
+        {
+            timeline_flag = true;
+            printf("[ CFG ]: Timeline flag on\n");
+        }
+        else if (strcmp(flag, "--timeline-run") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            timeline_run = atoi(shift_args(&argc, &argv));
+            if (timeline_run <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: --timeline-run must be a positive number of events\n");
+                exit(EXIT_FAILURE);
+            }
+            printf("[ CFG ]: Timeline run set to %d events\n", timeline_run);
+        }
+        else if (strcmp(flag, "--unordered") == 0)
+        {
+            unordered_flag = true;
+            printf("[ CFG ]: Unordered output flag on\n");
+        }
+        else if (strcmp(flag, "-j") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            num_threads = atoi(shift_args(&argc, &argv));
+            printf("[ CFG ]: Threads set to %d\n", num_threads);
+        }
+        else if (strcmp(flag, "--from") == 0 || strcmp(flag, "--to") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            const char *value = shift_args(&argc, &argv);
+            int64_t minutes = parse_filter_time(value);
+            if (minutes < 0)
+            {
+                fprintf(stderr, "[ ERR ]: %s expects yyyymmdd.hhmm, got '%s'\n", flag, value);
+                exit(EXIT_FAILURE);
+            }
+            if (strcmp(flag, "--from") == 0)
+                time_filter_from = minutes;
+            else
+                time_filter_to = minutes;
+            printf("[ CFG ]: Set %s to '%s'\n", flag + 2, value);
+        }
+        else if (strcmp(flag, "--site") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            site_filter_arg = shift_args(&argc, &argv);
+            printf("[ CFG ]: Set site filter to '%s'\n", site_filter_arg);
+        }
+        else if (strcmp(flag, "-R") == 0)
+        {
+            recursive_flag = true;
+            printf("[ CFG ]: Recursive input directory flag on\n");
+        }
+        else if (strcmp(flag, "--sort") == 0)
+        {
+            sort_flag = true;
+            printf("[ CFG ]: Sort input files flag on\n");
+        }
+        else if (strcmp(flag, "--prefetch") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
+            }
+            prefetch_depth = atoi(shift_args(&argc, &argv));
+            if (prefetch_depth < 0 || prefetch_depth > MAX_PREFETCH)
+            {
+                fprintf(stderr, "[ ERR ]: --prefetch must be between 0 and %d files\n", MAX_PREFETCH);
+                exit(EXIT_FAILURE);
+            }
+            printf("[ CFG ]: Prefetch set to %d files\n", prefetch_depth);
+        }
+        else if (strcmp(flag, "--direct-io") == 0)
+        {
+            direct_io_flag = true;
+            printf("[ CFG ]: Direct I/O input flag on\n");
+        }
+        else if (strcmp(flag, "--io-uring") == 0)
+        {
+            io_uring_flag = true;
+            printf("[ CFG ]: io_uring input flag on\n");
+        }
         else if (strcmp(flag, "-i") == 0)
         {
             if (argc <= 0)
@@ -1043,9 +6575,20 @@ int parse_args(int argc, char **argv)
             }
             else
             {
-                output_dir = shift_args(&argc, &argv);
-                printf("[ CFG ]: Set output directory to '%s'\n", output_dir);
+                const char *path = shift_args(&argc, &argv);
+                nob_da_append(&input_paths, path);
+                printf("[ CFG ]: Add input directory '%s'\n", path);
+            }
+        }
+        else if (strcmp(flag, "--file-list") == 0)
+        {
+            if (argc <= 0)
+            {
+                fprintf(stderr, "[ ERR ]: no value is provided for %s\n", flag);
+                exit(EXIT_FAILURE);
             }
+            file_list_arg = shift_args(&argc, &argv);
+            printf("[ CFG ]: Set file list to '%s'\n", file_list_arg);
         }
         else if (strcmp(flag, "-o") == 0)
         {
@@ -1065,16 +6608,28 @@ int parse_args(int argc, char **argv)
             usage(program);
             exit(EXIT_FAILURE);
         }
+        else if (flag[0] != '-')
+        {
+            nob_da_append(&input_paths, flag);
+            printf("[ CFG ]: Add input file '%s'\n", flag);
+        }
         else
         {
             printf("[ WRN ]: Unkown flag %s\n", flag);
         }
     }
 
-    if (!input_dir)
+    if (aggregate_flag && (merge_flag || timeline_flag))
+    {
+        // --aggregate only counts events, there would be no records to merge
+        fprintf(stderr, "[ ERR ]: --aggregate can not be used with %s\n", merge_flag ? "--merge" : "--timeline");
+        exit(EXIT_FAILURE);
+    }
+
+    if (input_paths.count == 0 && !file_list_arg)
     {
-        input_dir = "./input";
-        printf("[ CFG ]: Set input directory to default '%s'\n", input_dir);
+        nob_da_append(&input_paths, "./input");
+        printf("[ CFG ]: Set input directory to default '%s'\n", input_paths.items[0]);
     }
     if (!output_dir)
     {
@@ -1089,13 +6644,69 @@ void usage(const char *program)
 {
     fprintf(stderr, "Usage: %s [OPTIONS...] [FILES...]\n", program);
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "    -i <path>     set input directory (mandatory argument)\n");
+    fprintf(stderr, "    -i <path>     add input directory, may be repeated (default ./input)\n");
     fprintf(stderr, "    -o <path>     set output directory (mandatory argument)\n");
     fprintf(stderr, "    -r <int>      set max number of records to be parsed (0 - unlimited; 10 - default)\n");
     fprintf(stderr, "    -l            print record content to stdout (default off)\n");
     fprintf(stderr, "    -c            print record content to stdout (default off)\n");
+    fprintf(stderr, "    -e <list>     only parse events in comma separated list of names or ids (--events)\n");
+    fprintf(stderr, "    -w <expr>     only parse events whose parameters match expr (--where)\n");
+    fprintf(stderr, "                  e.g. 'EVENT_PARAM_GLOBAL_CELL_ID == 1001 && EVENT_PARAM_RAC_UE_REF != 0'\n");
+    fprintf(stderr, "    --columns <spec>\n");
+    fprintf(stderr, "                  decode params to ctr_events_*.csv, spec is EVENT:PARAM,...;EVENT:*\n");
+    fprintf(stderr, "                  (EVENT and PARAM may be '*' for all)\n");
+    fprintf(stderr, "    --blobs       write byte array params to ctr_blobs_*.bin, csv keeps offset,length\n");
+    fprintf(stderr, "    --on-error <resync|quarantine>\n");
+    fprintf(stderr, "                  on bad framing skip to the next valid record (default) or\n");
+    fprintf(stderr, "                  drop the file and list it in ctr_files_quarantined.csv\n");
+    fprintf(stderr, "    --inventory   only read header and footer of each file to ctr_inventory.csv\n");
+    fprintf(stderr, "    --rollup      merge ctr_aggregate.csv and ctr_kpi_sketches.csv of earlier runs, given as\n");
+    fprintf(stderr, "                  files or directories, into rop, hourly and daily ctr_rollup_*.csv stores\n");
+    fprintf(stderr, "                  of the output directory; their rops replace what the stores held\n");
+    fprintf(stderr, "                  (KPI sketches for all sites, they are not kept per site)\n");
+    fprintf(stderr, "    --aggregate   count events and bytes per site, date, rop and event to ctr_aggregate.csv\n");
+    fprintf(stderr, "                  (no records are kept, so not with --merge or --timeline)\n");
+    fprintf(stderr, "    --merge       merge the records of all files of a site by time to ctr_merged_<site>.csv\n");
+    fprintf(stderr, "    --timeline    sort the events of all sites by time to ctr_timeline.csv\n");
+    fprintf(stderr, "    --timeline-run <int>\n");
+    fprintf(stderr, "                  events sorted in memory before spilling to a temporary file (1048576, default)\n");
+    fprintf(stderr, "    --kpi <path>  count events per param value to ctr_kpi.csv, one definition per line:\n");
+    fprintf(stderr, "                  <KPI> = count <EVENT> grouped by <PARAM> [where <expr>]\n");
+    fprintf(stderr, "                  <KPI> = distinct <PARAM> of <EVENT> grouped by <PARAM> [where <expr>]\n");
+    fprintf(stderr, "                  <KPI> = top <N> <PARAM> of <EVENT> [where <expr>]\n");
+    fprintf(stderr, "    --kpi-bin <seconds>\n");
+    fprintf(stderr, "                  count the --kpi counters per time bin of each rop\n");
+    fprintf(stderr, "    --sessions <param>\n");
+    fprintf(stderr, "                  correlate events on a UE reference param to ctr_sessions.csv\n");
+    fprintf(stderr, "    --session-timeout <seconds>\n");
+    fprintf(stderr, "                  close a session after this long without events (30, default)\n");
+    fprintf(stderr, "    --latency <path>\n");
+    fprintf(stderr, "                  request/response latency percentiles per cell to ctr_latency.csv:\n");
+    fprintf(stderr, "                  <NAME> = <REQUEST> -> <RESPONSE> by <UE_PARAM> per <CELL_PARAM>\n");
+    fprintf(stderr, "    --sample <int>\n");
+    fprintf(stderr, "                  only keep the events of 1 in N UEs, picked by a hash of the UE param\n");
+    fprintf(stderr, "    --sample-param <param>\n");
+    fprintf(stderr, "                  UE param hashed by --sample (EVENT_PARAM_RAC_UE_REF, default)\n");
+    fprintf(stderr, "    -j <int>      set number of threads (0 - number of cpus, default)\n");
+    fprintf(stderr, "    --decoders <int>\n");
+    fprintf(stderr, "                  set number of threads parsing files (1, default)\n");
+    fprintf(stderr, "    --unordered   write files as they are parsed, not in input order\n");
+    fprintf(stderr, "    --from <yyyymmdd.hhmm>, --to <yyyymmdd.hhmm>\n");
+    fprintf(stderr, "                  only parse files whose rop starts in [from, to), in the files' local time\n");
+    fprintf(stderr, "    --site <list> only parse files of the comma separated node names\n");
+    fprintf(stderr, "    -R            also parse files in sub directories of the input directory\n");
+    fprintf(stderr, "    --sort        list all input files and parse them sorted by path (default\n");
+    fprintf(stderr, "                  is directory order, parsing while the directory is listed)\n");
+    fprintf(stderr, "    --file-list <path>\n");
+    fprintf(stderr, "                  parse the files listed one per line in path ('-' for stdin)\n");
+    fprintf(stderr, "    --prefetch <int>\n");
+    fprintf(stderr, "                  set number of files read ahead of the parser (0 - off; 4 - default)\n");
+    fprintf(stderr, "    --io-uring    open and read prefetched files in batches with io_uring\n");
+    fprintf(stderr, "    --direct-io   read input with O_DIRECT, bypassing the page cache\n");
     fprintf(stderr, "    -v            set verbose\n");
     fprintf(stderr, "    -h            print usage and exit\n");
+    fprintf(stderr, "Files:\n");
+    fprintf(stderr, "    input files or directories given after the options are parsed as well\n");
     fprintf(stderr, "Example:\n");
     fprintf(stderr, "    $ %s -r 0 -l -i ./input -o ./output\n", program);
     fprintf(stderr, "    list records to stdout.\n");
@@ -1107,21 +6718,40 @@ void usage(const char *program)
 int main(int argc, char **argv)
 {
     EventConfig *config_head = NULL;
-    CTRStruct *ctr_head = NULL;
 
     printf("Config:\n");
     printf("------------------------------------------------------------------------\n");
 
     parse_args(argc, argv);
 
+    if (inventory_flag)
+        return inventory_files();
+
+    if (rollup_flag)
+        return rollup();
+
     config_head = load_event_config(PmEventParams_filepath);
     if (!config_head)
         exit(EXIT_FAILURE);
 
     // load_event_format_config(PmEventParams_filepath, config_head);
 
-    ctr_head = parse_events();
-    if (!ctr_head)
+    if (event_filter_arg)
+        resolve_event_filter(event_filter_arg);
+    if (event_predicate_arg)
+        event_predicate = compile_event_predicate(event_predicate_arg);
+    if (kpi_definitions_arg)
+        load_kpi_definitions(kpi_definitions_arg);
+    if (session_key_arg)
+        resolve_session_key(session_key_arg);
+    if (sample_rate > 1)
+        resolve_sample_param(sample_param_arg);
+    if (latency_definitions_arg)
+        load_latency_definitions(latency_definitions_arg);
+    if (event_columns_arg)
+        resolve_event_columns(event_columns_arg);
+
+    if (parse_events() == 0)
         exit(EXIT_FAILURE);
 
     return EXIT_SUCCESS;